@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmutil.h"
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench(const char *label, uint32_t flags, size_t size, int reopen)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/first_touch_%d", (int)getpid());
+
+    uint64_t start = now_ns();
+    shm_info_t *shm = shared_memory_create_ex(name, size, reopen ? 0 : flags);
+    if (shm != NULL && reopen) {
+        // measure the attach side, segment already has its pages
+        shared_memory_prefault(shm, 0);
+        shared_memory_close(shm);
+        start = now_ns();
+        shm = shared_memory_open_ex(name, flags);
+    }
+    if (shm == NULL) {
+        printf("%-20s create error\n", label);
+        return;
+    }
+    uint64_t setup = now_ns() - start;
+
+    size_t pages = shm->size / shm->pagesize;
+    uint64_t *cost = malloc(sizeof(uint64_t) * pages);
+    if (cost == NULL) {
+        printf("%-20s malloc error\n", label);
+        shared_memory_close(shm);
+        shared_memory_remove(name);
+        return;
+    }
+    volatile uint8_t *p = shm->ptr;
+    for (size_t i = 0; i < pages; i++) {
+        uint64_t t = now_ns();
+        p[i * shm->pagesize] = 1;
+        cost[i] = now_ns() - t;
+    }
+    qsort(cost, pages, sizeof(uint64_t), cmp_u64);
+
+    printf("%-20s flags=%-2u setup_us=%-8llu p50=%-5llu p99=%-5llu p99.9=%-6llu max=%llu ns\n",
+           label, shm->flags, (unsigned long long)setup / 1000,
+           (unsigned long long)cost[pages / 2], (unsigned long long)cost[pages * 99 / 100],
+           (unsigned long long)cost[pages * 999 / 1000], (unsigned long long)cost[pages - 1]);
+
+    free(cost);
+    shared_memory_close(shm);
+    shared_memory_remove(name);
+}
+
+int main(int argc, char **argv)
+{
+    long mb = argc > 1 ? atol(argv[1]) : 256;
+    if (argc > 2 || mb <= 0) {
+        printf("usage: %s [size_mb]\n", argv[0]);
+        return -1;
+    }
+    size_t size = (size_t)mb << 20;
+
+    bench("create", 0, size, 0);
+    bench("create+populate", SHM_FLAG_POPULATE, size, 0);
+    bench("create+prefault", SHM_FLAG_PREFAULT, size, 0);
+    bench("create+lock", SHM_FLAG_LOCK, size, 0);
+    bench("open", 0, size, 1);
+    bench("open+populate", SHM_FLAG_POPULATE, size, 1);
+    bench("open+prefault", SHM_FLAG_PREFAULT, size, 1);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmutil.h"
+#include "shm_container.h"
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static void bench(const char *label, uint32_t flags, size_t size, int32_t elemsize, long ops)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/hugepage_bench_%d", (int)getpid());
+
+    shm_info_t *shm = shared_memory_create_ex(name, size, flags);
+    if (shm == NULL) {
+        printf("%-8s create error\n", label);
+        return;
+    }
+
+    int32_t count = (size - shared_memory_pool_size(elemsize, 1, 8)) / (elemsize + sizeof(int32_t));
+    while (shared_memory_pool_size(elemsize, count, 8) > shm->size)
+        count--;
+    shared_memory_pool_t *pool = shared_memory_pool_create(shm->ptr, elemsize, count, 8);
+    for (int32_t i = 0; i < count; i++) {
+        uint64_t *p = shared_memory_pool_malloc(pool);
+        *p = i;
+    }
+
+    uint64_t seed = 88172645463325252ull;
+    uint64_t sum = 0;
+    uint64_t start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        int32_t offset = xorshift(&seed) % count;
+        uint64_t *p = shared_memory_pool_pointer(pool, offset);
+        sum += *p;
+    }
+    uint64_t cost = now_ns() - start;
+
+    printf("%-8s flags=%u pagesize=%zu count=%d ns/op=%.2f (sum %llu)\n",
+           label, shm->flags, shm->pagesize, count, (double)cost / ops, (unsigned long long)sum);
+
+    shared_memory_close(shm);
+    shared_memory_remove(name);
+}
+
+int main(int argc, char **argv)
+{
+    long mb = argc > 1 ? atol(argv[1]) : 1024;
+    int32_t elemsize = argc > 2 ? atoi(argv[2]) : 1024;
+    long ops = argc > 3 ? atol(argv[3]) : 10000000;
+    // every element holds a uint64_t
+    if (argc > 4 || mb <= 0 || elemsize < (int32_t)sizeof(uint64_t) || ops <= 0) {
+        printf("usage: %s [size_mb] [elemsize >= 8] [ops]\n", argv[0]);
+        return -1;
+    }
+    size_t size = (size_t)mb << 20;
+
+    bench("4k", 0, size, elemsize, ops);
+    bench("thp", SHM_FLAG_THP, size, elemsize, ops);
+    bench("hugetlb", SHM_FLAG_HUGETLB, size, elemsize, ops);
+    return 0;
+}
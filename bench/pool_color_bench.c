@@ -0,0 +1,128 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shmutil.h"
+#include "shm_container.h"
+
+#define MAX_LIST 16
+
+// hot part of every element, what a scan over all elements reads
+typedef struct {
+    uint64_t key;
+    uint64_t state;
+    uint64_t hits;
+} header_t;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ns per header of a scan, best of rounds
+static double bench(int32_t elemsize, int32_t count, uint32_t layout, uint32_t shm_flags, int rounds)
+{
+    size_t size = shared_memory_pool_size_ex(elemsize, count, 64, layout);
+    shm_info_t *shm = shared_memory_create_anon("pool_color_bench", size, shm_flags);
+    if (shm == NULL)
+        return -1;
+    double best = -1;
+    header_t **headers = NULL;
+    shared_memory_pool_t *pool = shared_memory_pool_create_ex(shm->ptr, elemsize, count, 64, layout);
+    if (pool == NULL)
+        goto out;
+    headers = malloc(sizeof(header_t *) * count);
+    if (headers == NULL)
+        goto out;
+    for (int32_t i = 0; i < count; i++) {
+        headers[i] = shared_memory_pool_malloc(pool);
+        if (headers[i] == NULL)
+            goto out;
+        memset(headers[i], 0, elemsize);
+        headers[i]->key = i;
+    }
+
+    uint64_t sum = 0;
+    for (int r = 0; r < rounds; r++) {
+        uint64_t start = now_ns();
+        for (int pass = 0; pass < 16; pass++) {
+            for (int32_t i = 0; i < count; i++) {
+                header_t *h = headers[i];
+                if (h->key % 4 == (uint64_t)pass % 4)
+                    h->hits++;
+                sum += h->state;
+            }
+        }
+        double ns = (double)(now_ns() - start) / (16.0 * count);
+        if (r == 0 || ns < best)
+            best = ns;
+    }
+    if (sum != 0)
+        printf("unexpected sum %llu\n", (unsigned long long)sum);
+
+out:
+    free(headers);
+    shared_memory_close(shm);
+    return best;
+}
+
+static int parse_list(char *arg, int32_t *list)
+{
+    int n = 0;
+    for (char *s = strtok(arg, ","); s != NULL && n < MAX_LIST; s = strtok(NULL, ","))
+        list[n++] = atoi(s);
+    return n;
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-s sizes] [-n counts] [-r rounds] [-H]\n"
+           "  scan the first line of every pool element, with and without SHM_POOL_COLOR\n"
+           "  -s  element sizes, default 1024,4096\n"
+           "  -n  element counts, default 64,256,1024,4096\n"
+           "  -r  rounds, best one is printed, default 20\n"
+           "  -H  transparent huge pages, element stride then also decides L2 sets\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    int32_t sizes[MAX_LIST] = {1024, 4096};
+    int32_t counts[MAX_LIST] = {64, 256, 1024, 4096};
+    int nsizes = 2, ncounts = 4, rounds = 20;
+    uint32_t shm_flags = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:r:Hh")) != -1) {
+        switch (opt) {
+        case 's': nsizes = parse_list(optarg, sizes); break;
+        case 'n': ncounts = parse_list(optarg, counts); break;
+        case 'r': rounds = atoi(optarg); break;
+        case 'H': shm_flags = SHM_FLAG_THP; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (rounds <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    for (int i = 0; i < nsizes; i++) {
+        for (int j = 0; j < ncounts; j++) {
+            if (sizes[i] <= 0 || counts[j] <= 0)
+                continue;
+            double plain = bench(sizes[i], counts[j], 0, shm_flags, rounds);
+            double color = bench(sizes[i], counts[j], SHM_POOL_COLOR, shm_flags, rounds);
+            if (plain < 0 || color < 0) {
+                printf("elemsize=%-6d count=%-6d create error\n", sizes[i], counts[j]);
+                continue;
+            }
+            printf("elemsize=%-6d count=%-6d plain=%6.2f color=%6.2f ns/header speedup=%.2fx\n", sizes[i],
+                   counts[j], plain, color, color > 0 ? plain / color : 0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "shmutil.h"
+#include "shm_container.h"
+#include "shm_sync.h"
+
+#define MAX_WORKERS 64
+#define MAX_LIST 16
+
+// log-linear histogram, 16 sub buckets per power of two, ~6% error
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS 1024
+
+enum {
+    BENCH_POOL = 0,
+    BENCH_QUEUE = 1,
+};
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t start;
+    uint64_t end;
+    uint64_t hist[HIST_BUCKETS];
+} bench_worker_t;
+
+// lives in shared memory, seen by threads and forked processes
+typedef struct {
+    shm_barrier_t barrier;
+    int64_t remaining;
+    bench_worker_t workers[MAX_WORKERS];
+    uint8_t object[0] __attribute__((aligned(64)));
+} bench_shared_t;
+
+typedef struct {
+    int type;
+    int workers;
+    int processes;
+    int cpu;
+    int32_t size;
+    int32_t depth;
+    uint32_t layout;
+    long ops;
+    bench_shared_t *shared;
+    shared_memory_pool_t *pool;
+    shared_queue_t *queue;
+} bench_run_t;
+
+typedef struct {
+    bench_run_t *run;
+    int index;
+} bench_arg_t;
+
+static int first_result = 1;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t v)
+{
+    if (v < (2u << HIST_SUB_BITS))
+        return v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + ((v >> shift) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+static uint64_t hist_value(int index)
+{
+    if (index < (2 << HIST_SUB_BITS))
+        return index;
+    int shift = (index >> HIST_SUB_BITS) - 1;
+    uint64_t sub = index & ((1u << HIST_SUB_BITS) - 1);
+    return ((1ull << HIST_SUB_BITS) | sub) << shift;
+}
+
+static void hist_record(bench_worker_t *w, uint64_t v)
+{
+    w->hist[hist_index(v)]++;
+    w->count++;
+    if (v > w->max)
+        w->max = v;
+}
+
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t count, double p)
+{
+    uint64_t target = count * p;
+    uint64_t sum = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        sum += hist[i];
+        if (sum > target)
+            return hist_value(i);
+    }
+    return 0;
+}
+
+static void pin_cpu(int cpu)
+{
+    if (cpu < 0)
+        return;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % (ncpu > 0 ? ncpu : 1), &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void bench_pool(bench_run_t *run, bench_worker_t *w)
+{
+    for (long i = 0; i < run->ops; i++) {
+        uint64_t t = now_ns();
+        void *p = shared_memory_pool_malloc(run->pool);
+        shared_memory_pool_free(run->pool, p);
+        hist_record(w, now_ns() - t);
+    }
+}
+
+static void bench_queue_put(bench_run_t *run, bench_worker_t *w, uint8_t *buffer)
+{
+    for (long i = 0; i < run->ops; i++) {
+        while (1) {
+            uint64_t t = now_ns();
+            int r = shared_queue_put(run->queue, buffer, run->size);
+            if (r > 0) {
+                hist_record(w, now_ns() - t);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static void bench_queue_get(bench_run_t *run, bench_worker_t *w, uint8_t *buffer)
+{
+    int64_t *remaining = &run->shared->remaining;
+    while (__atomic_load_n(remaining, __ATOMIC_RELAXED) > 0) {
+        uint64_t t = now_ns();
+        int r = shared_queue_get(run->queue, buffer, run->size);
+        if (r > 0) {
+            hist_record(w, now_ns() - t);
+            __atomic_sub_fetch(remaining, 1, __ATOMIC_RELAXED);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+static void *bench_worker(void *arg)
+{
+    bench_run_t *run = ((bench_arg_t *)arg)->run;
+    int index = ((bench_arg_t *)arg)->index;
+    bench_worker_t *w = &run->shared->workers[index];
+    pin_cpu(run->cpu < 0 ? -1 : run->cpu + index);
+
+    uint8_t *buffer = NULL;
+    if (run->type == BENCH_QUEUE) {
+        buffer = malloc(run->size);
+        memset(buffer, index, run->size);
+    }
+
+    shm_barrier_wait(&run->shared->barrier, SHM_WAIT_INFINITE);
+    w->start = now_ns();
+    if (run->type == BENCH_POOL) {
+        bench_pool(run, w);
+    } else if (run->workers == 1) {
+        // single worker, put then get the same message
+        for (long i = 0; i < run->ops; i++) {
+            uint64_t t = now_ns();
+            shared_queue_put(run->queue, buffer, run->size);
+            shared_queue_get(run->queue, buffer, run->size);
+            hist_record(w, now_ns() - t);
+        }
+    } else if (index < run->workers / 2) {
+        bench_queue_put(run, w, buffer);
+    } else {
+        bench_queue_get(run, w, buffer);
+    }
+    w->end = now_ns();
+
+    free(buffer);
+    return NULL;
+}
+
+static void bench_report(bench_run_t *run)
+{
+    static uint64_t hist[HIST_BUCKETS];
+    memset(hist, 0, sizeof(hist));
+    uint64_t count = 0, max = 0, start = UINT64_MAX, end = 0;
+    for (int i = 0; i < run->workers; i++) {
+        bench_worker_t *w = &run->shared->workers[i];
+        for (int j = 0; j < HIST_BUCKETS; j++)
+            hist[j] += w->hist[j];
+        count += w->count;
+        max = w->max > max ? w->max : max;
+        start = w->start < start ? w->start : start;
+        end = w->end > end ? w->end : end;
+    }
+
+    // queue with producers and consumers, a message is one put and one get
+    uint64_t messages = run->type == BENCH_QUEUE && run->workers > 1 ? count / 2 : count;
+    double seconds = (end - start) / 1e9;
+    printf("%s    {\"bench\": \"%s\", \"mode\": \"%s\", \"workers\": %d, \"size\": %d, \"depth\": %d, "
+           "\"layout\": %u, \"ops\": %llu, \"ops_per_sec\": %.0f, \"ns_p50\": %llu, \"ns_p99\": %llu, \"ns_p999\": %llu, "
+           "\"ns_max\": %llu}",
+           first_result ? "" : ",\n", run->type == BENCH_POOL ? "pool_malloc_free" : "queue_put_get",
+           run->processes ? "process" : "thread", run->workers, run->size, run->depth, run->layout,
+           (unsigned long long)messages, seconds > 0 ? messages / seconds : 0,
+           (unsigned long long)hist_percentile(hist, count, 0.5),
+           (unsigned long long)hist_percentile(hist, count, 0.99),
+           (unsigned long long)hist_percentile(hist, count, 0.999), (unsigned long long)max);
+    fflush(stdout);
+    first_result = 0;
+}
+
+static int bench_run(bench_run_t *run)
+{
+    size_t objsize;
+    if (run->type == BENCH_POOL)
+        objsize = shared_memory_pool_size_ex(run->size, run->workers * 2, 64, run->layout);
+    else
+        objsize = shared_queue_size((size_t)run->depth * (run->size + sizeof(int)));
+
+    shm_info_t *shm = shared_memory_create_anon("shm_bench", sizeof(bench_shared_t) + objsize, 0);
+    if (shm == NULL) {
+        fprintf(stderr, "create shared memory fail\n");
+        return -1;
+    }
+    run->shared = shm->ptr;
+    shm_barrier_create(&run->shared->barrier, run->workers);
+    if (run->type == BENCH_POOL) {
+        run->pool = shared_memory_pool_create_ex(run->shared->object, run->size, run->workers * 2, 64, run->layout);
+    } else {
+        run->queue = shared_queue_create(run->shared->object, (size_t)run->depth * (run->size + sizeof(int)));
+        run->shared->remaining = (int64_t)(run->workers / 2) * run->ops;
+    }
+
+    bench_arg_t args[MAX_WORKERS];
+    pthread_t threads[MAX_WORKERS];
+    pid_t pids[MAX_WORKERS];
+    for (int i = 0; i < run->workers; i++) {
+        args[i].run = run;
+        args[i].index = i;
+        // started workers would wait on the barrier forever, give up the whole run
+        if (!run->processes) {
+            int r = pthread_create(&threads[i], NULL, bench_worker, &args[i]);
+            if (r != 0) {
+                fprintf(stderr, "create thread fail: %s\n", strerror(r));
+                exit(1);
+            }
+        } else if ((pids[i] = fork()) == 0) {
+            bench_worker(&args[i]);
+            _exit(0);
+        } else if (pids[i] < 0) {
+            perror("fork");
+            for (int j = 0; j < i; j++)
+                kill(pids[j], SIGKILL);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < run->workers; i++) {
+        if (!run->processes)
+            pthread_join(threads[i], NULL);
+        else
+            waitpid(pids[i], NULL, 0);
+    }
+
+    bench_report(run);
+    shared_memory_close(shm);
+    return 0;
+}
+
+static int parse_list(char *arg, int32_t *list)
+{
+    int n = 0;
+    for (char *s = strtok(arg, ","); s != NULL && n < MAX_LIST; s = strtok(NULL, ","))
+        list[n++] = atoi(s);
+    return n;
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-t threads] [-p processes] [-n ops] [-c first_cpu] [-s sizes] [-d depths] [-l layout]\n"
+           "  -t  run with 1, 2, 4 .. threads workers, default 1\n"
+           "  -p  run with processes workers instead of threads\n"
+           "  -n  operations per worker, default 100000\n"
+           "  -c  pin worker i to cpu first_cpu + i, default no pinning\n"
+           "  -s  message sizes, default 8,64,512,4096,65536,1048576\n"
+           "  -d  queue depths in messages, default 16,256\n"
+           "  -l  pool layout SHM_POOL_* flags, default 0\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 1, processes = 0, cpu = -1;
+    uint32_t layout = 0;
+    long ops = 100000;
+    int32_t sizes[MAX_LIST] = {8, 64, 512, 4096, 65536, 1048576};
+    int32_t depths[MAX_LIST] = {16, 256};
+    int nsizes = 6, ndepths = 2;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:p:n:c:s:d:l:h")) != -1) {
+        switch (opt) {
+        case 't': threads = atoi(optarg); break;
+        case 'p': processes = atoi(optarg); break;
+        case 'n': ops = atol(optarg); break;
+        case 'c': cpu = atoi(optarg); break;
+        case 's': nsizes = parse_list(optarg, sizes); break;
+        case 'd': ndepths = parse_list(optarg, depths); break;
+        case 'l': layout = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : -1;
+        }
+    }
+    int max = processes > 0 ? processes : threads;
+    if (max < 1 || max > MAX_WORKERS || ops <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    printf("{\n  \"ops\": %ld, \"cpu\": %d, \"results\": [\n", ops, cpu);
+    for (int workers = 1;; workers = workers * 2 < max ? workers * 2 : max) {
+        bench_run_t run = {0};
+        run.workers = workers;
+        run.processes = processes > 0;
+        run.cpu = cpu;
+        run.layout = layout;
+        for (int i = 0; i < nsizes; i++) {
+            // 1 MB elements of a pool only test the free list, keep them small
+            if (sizes[i] > 65536 || sizes[i] <= 0)
+                continue;
+            run.type = BENCH_POOL;
+            run.size = sizes[i];
+            run.depth = 0;
+            run.ops = ops;
+            bench_run(&run);
+        }
+        for (int i = 0; i < nsizes; i++) {
+            for (int j = 0; j < ndepths; j++) {
+                if (sizes[i] <= 0 || depths[j] <= 0)
+                    continue;
+                run.type = BENCH_QUEUE;
+                run.size = sizes[i];
+                run.depth = depths[j];
+                // bound copied bytes of big messages
+                run.ops = ops < (1l << 30) / sizes[i] ? ops : (1l << 30) / sizes[i];
+                bench_run(&run);
+            }
+        }
+        if (workers == max)
+            break;
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
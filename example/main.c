@@ -9,6 +9,7 @@
 
 #include "shmutil.h"
 #include "shm_container.h"
+#include "shm_directory.h"
 
 void rand_data(void *data, size_t len)
 {
@@ -27,11 +28,7 @@ int hash(void *data, size_t len)
 }
 
 const size_t SHARE_ELEMSIZE = 1024;
-
-struct shared_context {
-    char pool_data[1024 * 300];
-    char queue_data[1200];
-};
+const size_t SHARE_SIZE = 1024 * 320;
 
 struct local_context {
     shared_memory_pool_t *pool;
@@ -40,21 +37,30 @@ struct local_context {
 
 void shared_context_create(void *ptr, struct local_context *local)
 {
-    struct shared_context *ctx = ptr;
+    shared_directory_t *dir = shared_directory_create(ptr, SHARE_SIZE, 16);
+    assert(dir != NULL);
+
+    local->pool = shared_directory_pool_create(dir, "example_pool", SHARE_ELEMSIZE, 256, 8);
+    assert(local->pool != NULL);
 
-    assert(shared_memory_pool_size(SHARE_ELEMSIZE, 256, 8) < sizeof(ctx->pool_data));
-    local->pool = shared_memory_pool_create(ctx->pool_data, SHARE_ELEMSIZE, 256, 8);
+    local->queue = shared_directory_queue_create(dir, "example_queue", 1024);
+    assert(local->queue != NULL);
 
-    assert(shared_queue_size(1024) < sizeof(ctx->queue_data));
-    local->queue = shared_queue_create(ctx->queue_data, 1024);
+    // wake clients blocked in shared_directory_wait
+    shared_directory_ready(dir, 1);
 }
 
-void shared_context_open(void *ptr, struct local_context *local)
+int shared_context_open(void *ptr, struct local_context *local)
 {
-    struct shared_context *ctx = ptr;
+    shared_directory_t *dir = shared_directory_wait(ptr, 5000);
+    if (dir == NULL)
+        return -1;
 
-    local->pool = shared_memory_pool_open(ctx->pool_data);
-    local->queue = shared_queue_open(ctx->queue_data);
+    local->pool = shared_directory_pool_open(dir, "example_pool");
+    local->queue = shared_directory_queue_open(dir, "example_queue");
+    if (local->pool == NULL || local->queue == NULL)
+        return -1;
+    return 0;
 }
 
 void server(void *shared_ptr)
@@ -89,7 +95,10 @@ void server(void *shared_ptr)
 void client(void *shared_ptr)
 {
     struct local_context local;
-    shared_context_open(shared_ptr, &local);
+    if (shared_context_open(shared_ptr, &local) != 0) {
+        printf("open context fail\n");
+        return;
+    }
 
     int sid;
     int offset;
@@ -134,7 +143,7 @@ int main(int argc, char **argv)
     shm_info_t *shm;
     srand(123456);
     if (master) {
-        shm = shared_memory_create(name, sizeof(struct shared_context));
+        shm = shared_memory_create(name, SHARE_SIZE);
         if (shm == NULL) {
             printf("create error\n");
             return -1;
@@ -150,16 +159,13 @@ int main(int argc, char **argv)
             return -1;
         }
     } else {
-        shm = shared_memory_open(name);
+        // server may not create the segment yet, objects in it are waited by directory
+        for (int i = 0; i < 50 && (shm = shared_memory_open(name)) == NULL; i++)
+            usleep(100000);
         if (shm == NULL) {
             printf("open error\n");
             return -1;
         }
-        if (shm->size != sizeof(struct shared_context)) {
-            printf("size error\n");
-            return -1;
-        }
-
         client(shm->ptr);
 
         shared_memory_close(shm);
@@ -0,0 +1,434 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <getopt.h>
+#include <mqueue.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "shmutil.h"
+#include "shm_container.h"
+#include "shm_rpc.h"
+
+#define MAX_SIZES 16
+#define WARMUP 1000
+#define QUEUE_DEPTH 4
+
+// HDR-style log-linear histogram, 128 sub buckets per power of two, < 1% error
+#define HIST_SUB_BITS 7
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} histogram_t;
+
+static int hist_index(uint64_t v)
+{
+    if (v < (2u << HIST_SUB_BITS))
+        return v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + ((v >> shift) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+static uint64_t hist_value(int index)
+{
+    if (index < (2 << HIST_SUB_BITS))
+        return index;
+    int shift = (index >> HIST_SUB_BITS) - 1;
+    uint64_t sub = index & ((1u << HIST_SUB_BITS) - 1);
+    return ((1ull << HIST_SUB_BITS) | sub) << shift;
+}
+
+static void hist_record(histogram_t *h, uint64_t v)
+{
+    h->buckets[hist_index(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static uint64_t hist_percentile(const histogram_t *h, double p)
+{
+    uint64_t target = h->count * p;
+    uint64_t sum = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        sum += h->buckets[i];
+        if (sum > target)
+            return hist_value(i);
+    }
+    return h->max;
+}
+
+// timestamp in ns, rdtsc is scaled by a calibration against CLOCK_MONOTONIC
+static int use_tsc = 0;
+static double tsc_ns = 1.0;
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t now_ns()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (use_tsc)
+        return __rdtsc() * tsc_ns;
+#endif
+    return monotonic_ns();
+}
+
+static int tsc_calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t t0 = monotonic_ns(), c0 = __rdtsc();
+    usleep(50000);
+    uint64_t t1 = monotonic_ns(), c1 = __rdtsc();
+    tsc_ns = (double)(t1 - t0) / (c1 - c0);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static void pin_cpu(int cpu)
+{
+    if (cpu < 0)
+        return;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % (ncpu > 0 ? ncpu : 1), &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+// channel 0 carries ping from parent to peer, channel 1 carries pong back
+typedef struct transport transport_t;
+struct transport {
+    const char *name;
+    int (*open)(transport_t *t, int size);
+    int (*send)(transport_t *t, int channel, void *buf, int len);
+    int (*recv)(transport_t *t, int channel, void *buf, int len);
+    void (*close)(transport_t *t);
+
+    int fds[4];
+    mqd_t mqs[2];
+    shm_info_t *shm;
+    shared_queue_t *queues[2];
+    shm_rpc_t *rpc;
+    shm_rpc_request_t request;
+    void *call_buf;
+    int call_len;
+};
+
+static int write_full(int fd, void *buf, int len)
+{
+    for (int n = 0; n < len;) {
+        ssize_t r = write(fd, (uint8_t *)buf + n, len - n);
+        if (r <= 0)
+            return -1;
+        n += r;
+    }
+    return len;
+}
+
+static int read_full(int fd, void *buf, int len)
+{
+    for (int n = 0; n < len;) {
+        ssize_t r = read(fd, (uint8_t *)buf + n, len - n);
+        if (r <= 0)
+            return -1;
+        n += r;
+    }
+    return len;
+}
+
+static void fds_close(transport_t *t)
+{
+    for (int i = 0; i < 4; i++) {
+        if (t->fds[i] >= 0)
+            close(t->fds[i]);
+        t->fds[i] = -1;
+    }
+}
+
+static int queue_open(transport_t *t, int size)
+{
+    size_t qsize = shared_queue_size((size_t)QUEUE_DEPTH * (size + sizeof(int)));
+    t->shm = shared_memory_create_anon("shm_latency", qsize * 2, 0);
+    if (t->shm == NULL)
+        return -1;
+    t->queues[0] = shared_queue_create(t->shm->ptr, (size_t)QUEUE_DEPTH * (size + sizeof(int)));
+    t->queues[1] = shared_queue_create((uint8_t *)t->shm->ptr + qsize, (size_t)QUEUE_DEPTH * (size + sizeof(int)));
+    return 0;
+}
+
+static int queue_send(transport_t *t, int channel, void *buf, int len)
+{
+    while (shared_queue_put(t->queues[channel], buf, len) <= 0)
+        sched_yield();
+    return len;
+}
+
+static int queue_recv(transport_t *t, int channel, void *buf, int len)
+{
+    // busy poll, yield now and then so a shared cpu still makes progress
+    for (uint32_t spin = 0;; spin++) {
+        int r = shared_queue_get(t->queues[channel], buf, len);
+        if (r != 0)
+            return r;
+        if ((spin & 1023) == 1023)
+            sched_yield();
+    }
+}
+
+static void queue_close(transport_t *t)
+{
+    shared_memory_close(t->shm);
+}
+
+static int rpc_open(transport_t *t, int size)
+{
+    t->shm = shared_memory_create_anon("shm_latency", shm_rpc_size(1, size), 0);
+    if (t->shm == NULL)
+        return -1;
+    t->rpc = shm_rpc_create(t->shm->ptr, 1, size);
+    return 0;
+}
+
+// a call is one round trip, ping is kept until the pong is asked for
+static int rpc_send(transport_t *t, int channel, void *buf, int len)
+{
+    if (channel == 1)
+        return shm_rpc_reply(t->rpc, &t->request, buf, len) == 0 ? len : -1;
+    t->call_buf = buf;
+    t->call_len = len;
+    return len;
+}
+
+static int rpc_recv(transport_t *t, int channel, void *buf, int len)
+{
+    if (channel == 0)
+        return shm_rpc_recv(t->rpc, &t->request, buf, &len, SHM_WAIT_INFINITE) == 0 ? len : -1;
+    return shm_rpc_call(t->rpc, 0, t->call_buf, t->call_len, buf, &len, SHM_WAIT_INFINITE) == 0 ? len : -1;
+}
+
+static int pipe_open(transport_t *t, int size)
+{
+    if (pipe(t->fds) != 0)
+        return -1;
+    if (pipe(t->fds + 2) != 0) {
+        fds_close(t);
+        return -1;
+    }
+    return 0;
+}
+
+static int pipe_send(transport_t *t, int channel, void *buf, int len)
+{
+    return write_full(t->fds[channel * 2 + 1], buf, len);
+}
+
+static int pipe_recv(transport_t *t, int channel, void *buf, int len)
+{
+    return read_full(t->fds[channel * 2], buf, len);
+}
+
+static int unix_open(transport_t *t, int size)
+{
+    // one stream pair, fds[0] is the parent end, fds[1] the peer end
+    return socketpair(AF_UNIX, SOCK_STREAM, 0, t->fds);
+}
+
+static int unix_send(transport_t *t, int channel, void *buf, int len)
+{
+    return write_full(t->fds[channel], buf, len);
+}
+
+static int unix_recv(transport_t *t, int channel, void *buf, int len)
+{
+    return read_full(t->fds[1 - channel], buf, len);
+}
+
+static int mq_transport_open(transport_t *t, int size)
+{
+    struct mq_attr attr = {0};
+    attr.mq_maxmsg = QUEUE_DEPTH;
+    attr.mq_msgsize = size;
+    for (int i = 0; i < 2; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "/shm_latency_%d_%d", (int)getpid(), i);
+        t->mqs[i] = mq_open(name, O_CREAT | O_RDWR, 0600, &attr);
+        // descriptors are inherited by the peer, the name is not needed
+        mq_unlink(name);
+        if (t->mqs[i] == (mqd_t)-1) {
+            if (i == 1)
+                mq_close(t->mqs[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int mq_transport_send(transport_t *t, int channel, void *buf, int len)
+{
+    return mq_send(t->mqs[channel], buf, len, 0) == 0 ? len : -1;
+}
+
+static int mq_transport_recv(transport_t *t, int channel, void *buf, int len)
+{
+    return mq_receive(t->mqs[channel], buf, len, NULL);
+}
+
+static void mq_transport_close(transport_t *t)
+{
+    mq_close(t->mqs[0]);
+    mq_close(t->mqs[1]);
+}
+
+static transport_t transports[] = {
+    {"shared_queue", queue_open, queue_send, queue_recv, queue_close},
+    {"shm_rpc", rpc_open, rpc_send, rpc_recv, queue_close},
+    {"pipe", pipe_open, pipe_send, pipe_recv, fds_close},
+    {"unix_socket", unix_open, unix_send, unix_recv, fds_close},
+    {"mqueue", mq_transport_open, mq_transport_send, mq_transport_recv, mq_transport_close},
+};
+
+static histogram_t oneway;
+static histogram_t roundtrip;
+
+// message starts with send time of ping, then receive time at the peer
+static void run(transport_t *t, int size, long iterations, int cpu)
+{
+    for (int i = 0; i < 4; i++)
+        t->fds[i] = -1;
+    if (t->open(t, size) != 0) {
+        printf("%-14s %8d  open fail, skipped\n", t->name, size);
+        return;
+    }
+
+    uint8_t *buf = calloc(1, size);
+    long total = iterations + WARMUP;
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("%-14s %8d  fork fail\n", t->name, size);
+        goto out;
+    }
+    if (pid == 0) {
+        pin_cpu(cpu < 0 ? -1 : cpu + 1);
+        for (long i = 0; i < total; i++) {
+            if (t->recv(t, 0, buf, size) != size)
+                _exit(1);
+            uint64_t t1 = now_ns();
+            memcpy(buf + sizeof(uint64_t), &t1, sizeof(t1));
+            if (t->send(t, 1, buf, size) != size)
+                _exit(1);
+        }
+        _exit(0);
+    }
+
+    pin_cpu(cpu);
+    memset(&oneway, 0, sizeof(oneway));
+    memset(&roundtrip, 0, sizeof(roundtrip));
+    int failed = 0;
+    for (long i = 0; i < total; i++) {
+        uint64_t t0 = now_ns(), t1;
+        memcpy(buf, &t0, sizeof(t0));
+        if (t->send(t, 0, buf, size) != size || t->recv(t, 1, buf, size) != size) {
+            printf("%-14s %8d  transfer fail\n", t->name, size);
+            failed = 1;
+            break;
+        }
+        uint64_t t2 = now_ns();
+        memcpy(&t1, buf + sizeof(uint64_t), sizeof(t1));
+        if (i < WARMUP)
+            continue;
+        hist_record(&oneway, t1 > t0 ? t1 - t0 : 0);
+        hist_record(&roundtrip, t2 - t0);
+    }
+    // child may be blocked in recv for a message never sent
+    if (failed)
+        kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    if (failed)
+        goto out;
+
+    printf("%-14s %8d  %8llu %8llu %8llu %10llu  %8llu %8llu %8llu %10llu\n", t->name, size,
+           (unsigned long long)hist_percentile(&oneway, 0.5), (unsigned long long)hist_percentile(&oneway, 0.99),
+           (unsigned long long)hist_percentile(&oneway, 0.999), (unsigned long long)oneway.max,
+           (unsigned long long)hist_percentile(&roundtrip, 0.5),
+           (unsigned long long)hist_percentile(&roundtrip, 0.99),
+           (unsigned long long)hist_percentile(&roundtrip, 0.999), (unsigned long long)roundtrip.max);
+    fflush(stdout);
+
+out:
+    free(buf);
+    t->close(t);
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-n iterations] [-s sizes] [-c cpu] [-t]\n"
+           "  -n  round trips per transport and size, default 100000\n"
+           "  -s  message sizes, >= 16, default 16,64,1024,4096\n"
+           "  -c  pin to cpu, the echo peer to cpu + 1, default no pinning\n"
+           "  -t  timestamp with rdtsc instead of CLOCK_MONOTONIC\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = 100000;
+    int cpu = -1;
+    int sizes[MAX_SIZES] = {16, 64, 1024, 4096};
+    int nsizes = 4;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:c:th")) != -1) {
+        switch (opt) {
+        case 'n': iterations = atol(optarg); break;
+        case 'c': cpu = atoi(optarg); break;
+        case 't': use_tsc = 1; break;
+        case 's':
+            nsizes = 0;
+            for (char *s = strtok(optarg, ","); s != NULL && nsizes < MAX_SIZES; s = strtok(NULL, ","))
+                sizes[nsizes++] = atoi(s);
+            break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : -1;
+        }
+    }
+    for (int i = 0; i < nsizes; i++) {
+        if (sizes[i] < (int)(2 * sizeof(uint64_t))) {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (iterations <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (use_tsc && tsc_calibrate() != 0) {
+        printf("rdtsc is not supported, use CLOCK_MONOTONIC\n");
+        use_tsc = 0;
+    }
+
+    printf("%-14s %8s  %8s %8s %8s %10s  %8s %8s %8s %10s\n", "transport", "size",
+           "1way_p50", "p99", "p99.9", "max", "rtt_p50", "p99", "p99.9", "max");
+    for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]); i++) {
+        for (int j = 0; j < nsizes; j++)
+            run(&transports[i], sizes[j], iterations, cpu);
+    }
+    return 0;
+}
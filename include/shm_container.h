@@ -3,10 +3,22 @@
 #include <stdint.h>
 #include <pthread.h>
 
+#include "shmutil.h"
+#include "shm_lock.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief shared memory pool layout flags
+ */
+enum {
+    SHM_POOL_INTRUSIVE = 0x01,  // next free index in the free element, in use bitmap instead of int32 meta array
+    SHM_POOL_BITMAP = 0x02,     // free slots found by scanning a bitmap, support shared_memory_pool_malloc_n
+    SHM_POOL_COLOR = 0x04,      // pad elemsize to an odd count of cache lines, align <= 64 only
+};
+
 /**
  * @brief shared memory pool
  */
@@ -18,8 +30,11 @@ typedef struct {
     // private field
     uint32_t flag;
     int32_t datapos;
-    pthread_spinlock_t mutex;
+    shm_lock_t mutex;
     int32_t first;
+    uint32_t shift;     // trailing zero bits of elemsize
+    uint32_t layout;    // SHM_POOL_*
+    uint64_t inverse;   // inverse of elemsize >> shift modulo 2^64
     uint8_t data[0];
 } shared_memory_pool_t;
 
@@ -31,6 +46,16 @@ typedef struct {
  */
 extern size_t shared_memory_pool_size(int32_t elemsize, int32_t count, int32_t align);
 
+/**
+ * @brief get shared memory pool total size with layout flags
+ * @param elemsize element size
+ * @param count element count
+ * @param align element align
+ * @param flags SHM_POOL_*
+ * @return total size
+ */
+extern size_t shared_memory_pool_size_ex(int32_t elemsize, int32_t count, int32_t align, uint32_t flags);
+
 /**
  * @brief create shared memory pool
  * @param ptr shared memory pointer
@@ -40,10 +65,22 @@ extern size_t shared_memory_pool_size(int32_t elemsize, int32_t count, int32_t a
  */
 extern shared_memory_pool_t *shared_memory_pool_create(void *ptr, int32_t elemsize, int32_t count, int32_t align);
 
+/**
+ * @brief create shared memory pool with layout flags
+ * @param ptr shared memory pointer, at least shared_memory_pool_size_ex bytes
+ * @param elemsize element size, SHM_POOL_INTRUSIVE round it up to 4
+ * @param count element count
+ * @param align element align
+ * @param flags SHM_POOL_*
+ * @return NULL on fail
+ */
+extern shared_memory_pool_t *shared_memory_pool_create_ex(void *ptr, int32_t elemsize, int32_t count, int32_t align,
+                                                          uint32_t flags);
+
 /**
  * @brief open exist shared memory pool
  * @param ptr shared memory pointer
- * @return shared memory pool
+ * @return shared memory pool, NULL if not a pool or its layout is unknown
  */
 extern shared_memory_pool_t *shared_memory_pool_open(void *ptr);
 
@@ -60,6 +97,14 @@ extern void shared_memory_pool_clear(shared_memory_pool_t *pool);
  */
 extern void *shared_memory_pool_malloc(shared_memory_pool_t *pool);
 
+/**
+ * @brief malloc n adjacent elements, free the first one release all, thread safe
+ * @param pool shared memory pool, n > 1 needs SHM_POOL_BITMAP
+ * @param n element count
+ * @return first element, NULL on fail
+ */
+extern void *shared_memory_pool_malloc_n(shared_memory_pool_t *pool, int32_t n);
+
 /**
  * @brief free from shared memory pool, thread safe
  * @param pool shared memory pool
@@ -68,12 +113,23 @@ extern void *shared_memory_pool_malloc(shared_memory_pool_t *pool);
 extern void shared_memory_pool_free(shared_memory_pool_t *pool, void *ptr);
 
 /**
- * @brief get offset in shared memory pool, thread safe
+ * @brief get offset in shared memory pool without division, thread safe
  * @param pool shared memory pool
  * @param ptr pointer malloc by pool
  * @return offset in shared memory pool, -1 on fail
  */
-extern int32_t shared_memory_pool_offset(shared_memory_pool_t *pool, void *ptr);
+static inline int32_t shared_memory_pool_offset(shared_memory_pool_t *pool, void *ptr)
+{
+    // exact division by multiply with the odd part inverse, a pointer out
+    // of range or not on element boundary gives an index >= count
+    uint64_t df = (uint64_t)((uint8_t *)ptr - (pool->data + pool->datapos));
+    if (df & ((1ull << pool->shift) - 1))
+        return -1;
+    uint64_t offset = (df >> pool->shift) * pool->inverse;
+    if (offset >= (uint64_t)pool->count)
+        return -1;
+    return (int32_t)offset;
+}
 
 /**
  * @brief get pointer in shared memory pool, thread safe
@@ -83,6 +139,217 @@ extern int32_t shared_memory_pool_offset(shared_memory_pool_t *pool, void *ptr);
  */
 extern void *shared_memory_pool_pointer(shared_memory_pool_t *pool, int32_t offset);
 
+/**
+ * @brief snapshot of shared memory pool
+ */
+typedef struct {
+    int32_t elemsize;
+    int32_t count;
+    int32_t use_count;
+    uint32_t layout;        // SHM_POOL_*
+    int32_t free_count;     // free list length, -1 if list is changing or broken
+    uint32_t lock_owner;    // owner tid, 0 unlocked
+    uint32_t lock_waiters;  // 1 someone parked on the lock
+} shared_memory_pool_stat_t;
+
+/**
+ * @brief read pool state without lock, values may be inconsistent while others change it
+ * @param pool shared memory pool, can be mapped read only
+ * @param stat out: pool state
+ */
+extern void shared_memory_pool_stat(const shared_memory_pool_t *pool, shared_memory_pool_stat_t *stat);
+
+/**
+ * @brief shared memory pool sharded by numa node
+ */
+typedef struct {
+    int32_t elemsize;
+    int32_t count;
+    int32_t nshards;
+
+    // private field
+    uint32_t flag;
+    int32_t shard_count;
+    int32_t reserve;
+    uint64_t datapos;
+    uint64_t shard_size;
+} shared_memory_shard_t;
+
+/**
+ * @brief bits of element index in shard handle, high bits is shard id
+ */
+#define SHM_SHARD_INDEX_BITS 24
+
+/**
+ * @brief get sharded pool total size
+ * @param elemsize element size
+ * @param count element count of each shard
+ * @param nshards shard count, <= 0 for one shard per numa node
+ * @param align element align
+ * @return total size, 0 if total count overflow int32
+ */
+extern size_t shared_memory_shard_size(int32_t elemsize, int32_t count, int32_t nshards, int32_t align);
+
+/**
+ * @brief create sharded pool, shard N prefer numa node N % nodes
+ * @param ptr shared memory pointer, page aligned and not touched yet
+ * @param elemsize element size
+ * @param count element count of each shard
+ * @param nshards shard count, <= 0 for one shard per numa node
+ * @param align element align
+ * @return NULL on fail
+ */
+extern shared_memory_shard_t *shared_memory_shard_create(void *ptr, int32_t elemsize, int32_t count,
+                                                         int32_t nshards, int32_t align);
+
+/**
+ * @brief open exist sharded pool
+ * @param ptr shared memory pointer
+ * @return NULL on fail
+ */
+extern shared_memory_shard_t *shared_memory_shard_open(void *ptr);
+
+/**
+ * @brief get pool of one shard
+ * @param shard sharded pool
+ * @param index shard index
+ * @return NULL on fail
+ */
+extern shared_memory_pool_t *shared_memory_shard_pool(shared_memory_shard_t *shard, int32_t index);
+
+/**
+ * @brief malloc from shard of current numa node, steal from others if empty, thread safe
+ * @param shard sharded pool
+ * @return NULL on fail
+ */
+extern void *shared_memory_shard_malloc(shared_memory_shard_t *shard);
+
+/**
+ * @brief free to its own shard, thread safe
+ * @param shard sharded pool
+ * @param ptr pointer to free
+ */
+extern void shared_memory_shard_free(shared_memory_shard_t *shard, void *ptr);
+
+/**
+ * @brief get handle {shard id, index} in sharded pool, thread safe
+ * @param shard sharded pool
+ * @param ptr pointer malloc by shard
+ * @return handle in sharded pool, -1 on fail
+ */
+extern int32_t shared_memory_shard_offset(shared_memory_shard_t *shard, void *ptr);
+
+/**
+ * @brief get pointer in sharded pool, thread safe
+ * @param shard sharded pool
+ * @param offset handle in sharded pool
+ * @return NULL on fail
+ */
+extern void *shared_memory_shard_pointer(shared_memory_shard_t *shard, int32_t offset);
+
+/**
+ * @brief shared memory pool chained by segments, grow on demand
+ */
+typedef struct {
+    int32_t elemsize;
+    int32_t count;
+    int32_t use_count;
+
+    // private field
+    uint32_t flag;
+    int32_t chunk_count;
+    int32_t max_chunks;
+    int32_t align;
+    int32_t nchunks;
+    shm_lock_t mutex;
+    int32_t first;
+    char name[64];
+} shared_memory_chain_header_t;
+
+/**
+ * @brief chained pool handle, local to each process
+ */
+typedef struct {
+    shared_memory_chain_header_t *header;
+
+    // private field
+    pthread_mutex_t mutex;
+    shm_info_t **chunks;
+} shared_memory_chain_t;
+
+/**
+ * @brief bits of element index in chain handle, high bits is chunk id
+ */
+#define SHM_CHAIN_INDEX_BITS 24
+
+/**
+ * @brief get chained pool header size
+ * @return header size
+ */
+extern size_t shared_memory_chain_size();
+
+/**
+ * @brief create chained pool, chunk is shared memory named name.N
+ * @param ptr shared memory pointer for header
+ * @param name chunk name prefix used by shm_open
+ * @param elemsize element size
+ * @param chunk_count element count of each chunk
+ * @param max_chunks max chunk count
+ * @param align element align
+ * @return NULL on fail
+ */
+extern shared_memory_chain_t *shared_memory_chain_create(void *ptr, const char *name, int32_t elemsize,
+                                                         int32_t chunk_count, int32_t max_chunks, int32_t align);
+
+/**
+ * @brief open exist chained pool
+ * @param ptr shared memory pointer for header
+ * @return NULL on fail
+ */
+extern shared_memory_chain_t *shared_memory_chain_open(void *ptr);
+
+/**
+ * @brief close chained pool handle, chunks still exist
+ * @param chain chained pool
+ */
+extern void shared_memory_chain_close(shared_memory_chain_t *chain);
+
+/**
+ * @brief remove all chunks of chained pool
+ * @param chain chained pool
+ */
+extern void shared_memory_chain_remove(shared_memory_chain_t *chain);
+
+/**
+ * @brief malloc from chained pool, create new chunk if need, thread safe
+ * @param chain chained pool
+ * @return NULL on fail
+ */
+extern void *shared_memory_chain_malloc(shared_memory_chain_t *chain);
+
+/**
+ * @brief free from chained pool, thread safe
+ * @param chain chained pool
+ * @param ptr pointer to free
+ */
+extern void shared_memory_chain_free(shared_memory_chain_t *chain, void *ptr);
+
+/**
+ * @brief get handle {chunk id, index} in chained pool, thread safe
+ * @param chain chained pool
+ * @param ptr pointer malloc by chain
+ * @return handle in chained pool, -1 on fail
+ */
+extern int32_t shared_memory_chain_offset(shared_memory_chain_t *chain, void *ptr);
+
+/**
+ * @brief get pointer in chained pool, open chunk if need, thread safe
+ * @param chain chained pool
+ * @param offset handle in chained pool
+ * @return NULL on fail
+ */
+extern void *shared_memory_chain_pointer(shared_memory_chain_t *chain, int32_t offset);
+
 /**
  * @brief shared memory queue
  */
@@ -90,10 +357,11 @@ typedef struct {
     size_t size;
 
     // private field
-    pthread_mutex_t mutex;
+    shm_lock_t mutex;
     uint32_t flag;
     int32_t readpos;
     int32_t writepos;
+    int32_t shrinking;  // 1 while records are moved to front
     uint8_t data[0];
 } shared_queue_t;
 
@@ -137,6 +405,33 @@ extern int shared_queue_put(shared_queue_t *queue, void *data, int len);
  */
 extern int shared_queue_get(shared_queue_t *queue, void *buffer, int len);
 
+/**
+ * @brief gets data from the queue only if its length is len, thread safe
+ * @param queue shared queue
+ * @param buffer the buffer to be copied
+ * @param len the length of the data
+ * @return len on success, =0 no data, < 0 length differ and data is kept
+ */
+extern int shared_queue_get_exact(shared_queue_t *queue, void *buffer, int len);
+
+/**
+ * @brief snapshot of shared queue
+ */
+typedef struct {
+    size_t size;
+    int32_t readpos;
+    int32_t writepos;
+    int32_t records;        // record count, -1 if queue is changing or broken
+    uint32_t lock_owner;    // owner tid, 0 unlocked
+    uint32_t lock_waiters;  // 1 someone parked on the lock
+} shared_queue_stat_t;
+
+/**
+ * @brief read queue state without lock, values may be inconsistent while others change it
+ * @param queue shared queue, can be mapped read only
+ * @param stat out: queue state
+ */
+extern void shared_queue_stat(const shared_queue_t *queue, shared_queue_stat_t *stat);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,144 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "shm_container.h"
+#include "shm_lock.h"
+#include "shm_sync.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief object type in shared directory
+ */
+enum {
+    SHM_OBJECT_USER = 0,
+    SHM_OBJECT_POOL = 1,
+    SHM_OBJECT_QUEUE = 2,
+};
+
+/**
+ * @brief layout version of containers, bump when header layout change
+ */
+#define SHM_OBJECT_POOL_VERSION 3
+#define SHM_OBJECT_QUEUE_VERSION 2
+
+#define SHM_OBJECT_NAME_SIZE 32
+
+/**
+ * @brief shared directory entry
+ */
+typedef struct {
+    char name[SHM_OBJECT_NAME_SIZE];
+    uint32_t hash;
+    uint32_t type;
+    uint32_t version;
+    uint32_t reserve;
+    uint64_t offset;
+    uint64_t size;
+} shared_directory_entry_t;
+
+/**
+ * @brief named object directory at the start of a segment
+ */
+typedef struct {
+    uint64_t size;
+    int32_t capacity;
+    int32_t count;
+
+    // private field
+    shm_once_t ready;
+    uint32_t flag;
+    shm_lock_t mutex;
+    uint64_t top;
+    shared_directory_entry_t entries[0];
+} shared_directory_t;
+
+/**
+ * @brief create shared directory managing the whole memory
+ * @param ptr shared memory pointer
+ * @param size shared memory size
+ * @param capacity max object count, round up to 2^x
+ * @return NULL on fail
+ */
+extern shared_directory_t *shared_directory_create(void *ptr, size_t size, int32_t capacity);
+
+/**
+ * @brief open exist shared directory
+ * @param ptr shared memory pointer
+ * @return NULL on fail
+ */
+extern shared_directory_t *shared_directory_open(void *ptr);
+
+/**
+ * @brief mark all objects are created, wake processes in shared_directory_wait
+ * @param dir shared directory
+ * @param ok 1 ready, 0 init failed
+ */
+extern void shared_directory_ready(shared_directory_t *dir, int ok);
+
+/**
+ * @brief wait creator call shared_directory_ready and open shared directory,
+ * the memory may still be zero filled when called
+ * @param ptr shared memory pointer
+ * @param timeout_ms timeout in ms, SHM_WAIT_INFINITE for infinite
+ * @return NULL on fail or timeout
+ */
+extern shared_directory_t *shared_directory_wait(void *ptr, int timeout_ms);
+
+/**
+ * @brief alloc named object from shared directory, thread safe
+ * @param dir shared directory
+ * @param name object name, shorter than SHM_OBJECT_NAME_SIZE
+ * @param type SHM_OBJECT_*
+ * @param version object layout version
+ * @param size object size
+ * @param align object align, 2^x
+ * @return NULL on fail or name exist
+ */
+extern void *shared_directory_alloc(shared_directory_t *dir, const char *name, uint32_t type, uint32_t version,
+                                    size_t size, size_t align);
+
+/**
+ * @brief find named object in shared directory, lock free
+ * @param dir shared directory
+ * @param name object name
+ * @param type SHM_OBJECT_*
+ * @param version object layout version
+ * @param size out: object size, can be NULL
+ * @return NULL on fail or type/version mismatch
+ */
+extern void *shared_directory_find(shared_directory_t *dir, const char *name, uint32_t type, uint32_t version,
+                                   size_t *size);
+
+/**
+ * @brief create named shared memory pool in shared directory
+ * @return NULL on fail
+ */
+extern shared_memory_pool_t *shared_directory_pool_create(shared_directory_t *dir, const char *name,
+                                                          int32_t elemsize, int32_t count, int32_t align);
+
+/**
+ * @brief open named shared memory pool in shared directory
+ * @return NULL on fail
+ */
+extern shared_memory_pool_t *shared_directory_pool_open(shared_directory_t *dir, const char *name);
+
+/**
+ * @brief create named shared queue in shared directory
+ * @return NULL on fail
+ */
+extern shared_queue_t *shared_directory_queue_create(shared_directory_t *dir, const char *name, size_t size);
+
+/**
+ * @brief open named shared queue in shared directory
+ * @return NULL on fail
+ */
+extern shared_queue_t *shared_directory_queue_open(shared_directory_t *dir, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
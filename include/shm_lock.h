@@ -0,0 +1,186 @@
+#pragma once
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief process shared robust lock on a 32 bit futex word,
+ * same layout on every libc and word size
+ */
+typedef struct {
+    uint32_t state;     // owner tid | SHM_LOCK_WAITERS, 0 unlocked
+    uint32_t spin;
+} shm_lock_t;
+
+/**
+ * @brief default spin count before park in futex
+ */
+#define SHM_LOCK_DEFAULT_SPIN 100
+
+#define SHM_LOCK_WAITERS 0x80000000u
+#define SHM_LOCK_TID_MASK 0x3fffffffu
+
+/**
+ * @brief interval to check whether the owner is alive while parked
+ */
+#define SHM_LOCK_CHECK_MS 100
+
+/**
+ * @brief tid of current thread, cached, use shm_lock_self instead
+ */
+extern __thread uint32_t shm_lock_tid_cache;
+extern uint32_t shm_lock_tid_slow();
+
+static inline uint32_t shm_lock_self()
+{
+    uint32_t tid = shm_lock_tid_cache;
+    return tid != 0 ? tid : shm_lock_tid_slow();
+}
+
+/**
+ * @brief check whether thread tid exited, an unreaped zombie is dead too,
+ * pid namespace must be the same and tid reuse is not detected
+ * @param tid thread id
+ * @return 1 dead, 0 alive or unknown
+ */
+extern int shm_lock_owner_dead(uint32_t tid);
+
+/**
+ * @brief init lock in shared memory
+ * @param lock the lock pointer
+ * @param spin spin count before park, 0 park at once
+ */
+extern void shm_lock_create(shm_lock_t *lock, uint32_t spin);
+
+/**
+ * @brief acquire lock, slow path, use shm_lock_acquire instead
+ */
+extern int shm_lock_acquire_slow(shm_lock_t *lock);
+
+/**
+ * @brief release lock, slow path, use shm_lock_release instead
+ */
+extern void shm_lock_release_slow(shm_lock_t *lock);
+
+/**
+ * @brief try acquire lock
+ * @param lock the lock pointer
+ * @return 1 on success, 0 busy
+ */
+static inline int shm_lock_tryacquire(shm_lock_t *lock)
+{
+    uint32_t c = 0;
+    return __atomic_compare_exchange_n(&lock->state, &c, shm_lock_self(), 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief acquire lock, spin then park in futex
+ * @param lock the lock pointer
+ * @return 0 on success, EOWNERDEAD the owner died holding it, lock is
+ * acquired and data it protects must be checked
+ */
+static inline int shm_lock_acquire(shm_lock_t *lock)
+{
+    if (shm_lock_tryacquire(lock))
+        return 0;
+    return shm_lock_acquire_slow(lock);
+}
+
+/**
+ * @brief release lock, syscall only if someone parked
+ * @param lock the lock pointer
+ */
+static inline void shm_lock_release(shm_lock_t *lock)
+{
+    if (__atomic_exchange_n(&lock->state, 0, __ATOMIC_RELEASE) & SHM_LOCK_WAITERS)
+        shm_lock_release_slow(lock);
+}
+
+/**
+ * @brief get owner of lock
+ * @param lock the lock pointer
+ * @return owner tid, 0 unlocked
+ */
+static inline uint32_t shm_lock_owner(const shm_lock_t *lock)
+{
+    return __atomic_load_n(&lock->state, __ATOMIC_RELAXED) & SHM_LOCK_TID_MASK;
+}
+
+/**
+ * @brief reader slot of shm_rwlock_t, one cache line each
+ */
+typedef struct {
+    uint32_t count;
+    uint8_t pad[60];
+} shm_rwlock_slot_t;
+
+/**
+ * @brief process shared reader-writer lock, reader only touch its own slot,
+ * writer is preferred, readers back off while a writer is pending
+ */
+typedef struct {
+    uint32_t writer;
+    uint32_t nslots;
+    uint32_t spin;
+
+    // private field
+    uint32_t flag;
+    uint8_t pad[48];
+    shm_rwlock_slot_t slots[0];
+} shm_rwlock_t;
+
+/**
+ * @brief get reader-writer lock total size
+ * @param nslots reader slot count, 0 for one per cpu
+ * @return total size
+ */
+extern size_t shm_rwlock_size(uint32_t nslots);
+
+/**
+ * @brief create reader-writer lock
+ * @param ptr shared memory pointer, 64 bytes aligned
+ * @param nslots reader slot count, 0 for one per cpu, same as shm_rwlock_size
+ * @return NULL on fail
+ */
+extern shm_rwlock_t *shm_rwlock_create(void *ptr, uint32_t nslots);
+
+/**
+ * @brief open exist reader-writer lock
+ * @param ptr shared memory pointer
+ * @return NULL on fail
+ */
+extern shm_rwlock_t *shm_rwlock_open(void *ptr);
+
+/**
+ * @brief acquire read lock
+ * @param lock reader-writer lock
+ * @return reader slot, pass it to shm_rwlock_rdunlock
+ */
+extern uint32_t shm_rwlock_rdlock(shm_rwlock_t *lock);
+
+/**
+ * @brief release read lock
+ * @param lock reader-writer lock
+ * @param slot return by shm_rwlock_rdlock
+ */
+extern void shm_rwlock_rdunlock(shm_rwlock_t *lock, uint32_t slot);
+
+/**
+ * @brief acquire write lock, wait all reader slots drain
+ * @param lock reader-writer lock
+ */
+extern void shm_rwlock_wrlock(shm_rwlock_t *lock);
+
+/**
+ * @brief release write lock
+ * @param lock reader-writer lock
+ */
+extern void shm_rwlock_wrunlock(shm_rwlock_t *lock);
+
+#ifdef __cplusplus
+}
+#endif
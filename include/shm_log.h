@@ -0,0 +1,117 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "shmutil.h"
+#include "shm_lock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief msync policy of shared log
+ */
+enum {
+    SHM_LOG_SYNC_NONE = 0,      // leave write back to kernel
+    SHM_LOG_SYNC_SEGMENT = 1,   // msync segment when it is full
+    SHM_LOG_SYNC_RECORD = 2,    // msync every appended record
+};
+
+/**
+ * @brief shared log header, stored in the control file
+ */
+typedef struct {
+    uint64_t segsize;
+    uint64_t head;
+    uint64_t tail;
+
+    // private field
+    uint32_t flag;
+    uint32_t sync;
+    uint64_t boot;      // boot id the lock word belongs to, 0 while it is being reset
+    shm_lock_t mutex;
+} shm_log_header_t;
+
+/**
+ * @brief shared log, local to each process
+ */
+typedef struct {
+    shm_log_header_t *header;
+
+    // private field
+    shm_info_t *info;
+    char *path;
+    pthread_mutex_t mutex;
+    shm_info_t **segs;
+    uint32_t nsegs;
+} shm_log_t;
+
+/**
+ * @brief create new shared log, data is stored in path.N segment files,
+ * an old log at path is removed first
+ * @param path control file path, on disk or tmpfs
+ * @param segsize segment file size
+ * @param sync msync policy, SHM_LOG_SYNC_*
+ * @return NULL for error
+ */
+extern shm_log_t *shm_log_create(const char *path, uint64_t segsize, uint32_t sync);
+
+/**
+ * @brief open exist shared log
+ * @param path control file path
+ * @return NULL for error
+ */
+extern shm_log_t *shm_log_open(const char *path);
+
+/**
+ * @brief close shared log, files still exist
+ * @param log create by shm_log_create/shm_log_open
+ */
+extern void shm_log_close(shm_log_t *log);
+
+/**
+ * @brief remove control file and all segment files
+ * @param path control file path
+ * @return 0 on success, -1 on error
+ */
+extern int shm_log_remove(const char *path);
+
+/**
+ * @brief append record to the log, thread safe
+ * @param log shared log
+ * @param data the data to be added
+ * @param len the length of the data
+ * @return offset of the record, -1 on fail
+ */
+extern int64_t shm_log_append(shm_log_t *log, const void *data, uint32_t len);
+
+/**
+ * @brief read record at offset without copy, thread safe
+ * @param log shared log
+ * @param offset in: record offset, out: next record offset
+ * @param data out: pointer to record data, valid until log closed or trimmed
+ * @param len out: length of record data
+ * @return 1 one record read, 0 no more data, -1 fail
+ */
+extern int shm_log_read(shm_log_t *log, uint64_t *offset, const void **data, uint32_t *len);
+
+/**
+ * @brief msync all mapped segments and header
+ * @param log shared log
+ * @return 0 on success, -1 on error
+ */
+extern int shm_log_sync(shm_log_t *log);
+
+/**
+ * @brief remove whole segments before offset, thread safe
+ * @param log shared log
+ * @param offset records before it are not needed any more
+ * @return 0 on success, -1 on error
+ */
+extern int shm_log_trim(shm_log_t *log, uint64_t offset);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief self relative pointer, distance from the field itself, SHM_RELPTR_NULL is NULL,
+ * 0 points to the field itself, so zeroed memory must be cleared before use
+ * a structure using it keeps valid in every process and at any address,
+ * but it must not be copied to other place by value
+ */
+typedef intptr_t shm_relptr_t;
+
+// an odd distance never points to a shm_relptr_t field
+#define SHM_RELPTR_NULL ((shm_relptr_t)1)
+
+/**
+ * @brief offset pointer, distance from a base address, 0 is NULL
+ */
+typedef uintptr_t shm_offptr_t;
+
+/**
+ * @brief get pointer from self relative pointer
+ * @param rp pointer to self relative pointer field
+ * @return NULL if not set
+ */
+static inline void *shm_relptr_get(const shm_relptr_t *rp)
+{
+    return *rp == SHM_RELPTR_NULL ? NULL : (uint8_t *)rp + *rp;
+}
+
+/**
+ * @brief set self relative pointer
+ * @param rp pointer to self relative pointer field
+ * @param ptr target pointer, in the same segment, NULL to clear
+ */
+static inline void shm_relptr_set(shm_relptr_t *rp, const void *ptr)
+{
+    *rp = ptr == NULL ? SHM_RELPTR_NULL : (const uint8_t *)ptr - (const uint8_t *)rp;
+}
+
+/**
+ * @brief get pointer from offset pointer
+ * @param base base address of the segment
+ * @param off offset pointer
+ * @return NULL if off is 0
+ */
+static inline void *shm_offptr_get(const void *base, shm_offptr_t off)
+{
+    return off == 0 ? NULL : (uint8_t *)base + off;
+}
+
+/**
+ * @brief get offset pointer from pointer
+ * @param base base address of the segment
+ * @param ptr target pointer, in the same segment
+ * @return 0 if ptr is NULL
+ */
+static inline shm_offptr_t shm_offptr_make(const void *base, const void *ptr)
+{
+    return ptr == NULL ? 0 : (const uint8_t *)ptr - (const uint8_t *)base;
+}
+
+/**
+ * @brief typed access to self relative pointer field, eg:
+ * struct node { shm_relptr_t next; int value; };
+ * struct node *n = SHM_RELPTR_GET(struct node, head->next);
+ */
+#define SHM_RELPTR_GET(type, field) ((type *)shm_relptr_get(&(field)))
+#define SHM_RELPTR_SET(field, ptr) shm_relptr_set(&(field), (ptr))
+
+/**
+ * @brief typed access to offset pointer
+ */
+#define SHM_OFFPTR_GET(type, base, off) ((type *)shm_offptr_get((base), (off)))
+#define SHM_OFFPTR_MAKE(base, ptr) shm_offptr_make((base), (ptr))
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "shm_ptr.h"
+
+namespace shm {
+
+/**
+ * @brief self relative pointer for structures stored in shared memory
+ * it keeps the distance from itself, copy and assignment re-compute it,
+ * so a shm_ptr must live in the same segment as its target
+ */
+template <typename T>
+class shm_ptr {
+public:
+    shm_ptr() : off_(SHM_RELPTR_NULL) {}
+    shm_ptr(std::nullptr_t) : off_(SHM_RELPTR_NULL) {}
+    shm_ptr(T *p) { set(p); }
+    shm_ptr(const shm_ptr &o) { set(o.get()); }
+
+    shm_ptr &operator=(const shm_ptr &o)
+    {
+        set(o.get());
+        return *this;
+    }
+    shm_ptr &operator=(T *p)
+    {
+        set(p);
+        return *this;
+    }
+    shm_ptr &operator=(std::nullptr_t)
+    {
+        off_ = SHM_RELPTR_NULL;
+        return *this;
+    }
+
+    T *get() const { return static_cast<T *>(shm_relptr_get(&off_)); }
+    T &operator*() const { return *get(); }
+    T *operator->() const { return get(); }
+    T &operator[](std::ptrdiff_t i) const { return get()[i]; }
+    explicit operator bool() const { return off_ != SHM_RELPTR_NULL; }
+
+    friend bool operator==(const shm_ptr &a, const shm_ptr &b) { return a.get() == b.get(); }
+    friend bool operator!=(const shm_ptr &a, const shm_ptr &b) { return a.get() != b.get(); }
+    friend bool operator==(const shm_ptr &a, const T *b) { return a.get() == b; }
+    friend bool operator!=(const shm_ptr &a, const T *b) { return a.get() != b; }
+
+private:
+    void set(T *p) { shm_relptr_set(&off_, p); }
+
+    shm_relptr_t off_;
+};
+
+static_assert(sizeof(shm_ptr<int>) == sizeof(shm_relptr_t), "shm_ptr layout must match shm_relptr_t");
+
+} // namespace shm
@@ -0,0 +1,135 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shm_sync.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief request ring cell, one word so a stalled step can be finished by a CAS
+ */
+typedef struct {
+    uint64_t word;      // low 32 bits of position << 32 | slot
+} shm_rpc_cell_t;
+
+/**
+ * @brief one caller, request and response share data
+ */
+typedef struct {
+    uint32_t state;     // call id << 3 | phase, caller parks on it
+    uint32_t waiters;   // caller parked on state
+    uint32_t owner;     // attached tid, 0 free
+    uint32_t queued;    // tid that pushed this slot to the ring, 0 not in ring
+    int32_t len;        // request or response length
+    uint64_t server;    // call id << 32 | tid of the server that took it
+    uint8_t data[0] __attribute__((aligned(64)));
+} shm_rpc_slot_t;
+
+/**
+ * @brief request/response channel, callers attach a slot, servers take requests from a ring
+ */
+typedef struct {
+    int32_t nslots;
+    int32_t msgsize;
+
+    // private field
+    uint32_t flag;
+    uint32_t ring_mask;
+    uint64_t slotpos;
+    uint64_t slot_size;
+    shm_sem_t pending;  // requests in ring, servers park here
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    shm_rpc_cell_t ring[0] __attribute__((aligned(64)));
+} shm_rpc_t;
+
+/**
+ * @brief request taken by a server, pass back to shm_rpc_reply
+ */
+typedef struct {
+    int32_t slot;
+    uint32_t id;
+} shm_rpc_request_t;
+
+/**
+ * @brief get rpc channel total size
+ * @param nslots max attached callers
+ * @param msgsize max request and response size
+ * @return total size
+ */
+extern size_t shm_rpc_size(int32_t nslots, int32_t msgsize);
+
+/**
+ * @brief create rpc channel
+ * @param ptr shared memory pointer, 64 bytes aligned
+ * @param nslots max attached callers
+ * @param msgsize max request and response size
+ * @return NULL on fail
+ */
+extern shm_rpc_t *shm_rpc_create(void *ptr, int32_t nslots, int32_t msgsize);
+
+/**
+ * @brief open exist rpc channel
+ * @param ptr shared memory pointer
+ * @return NULL on fail
+ */
+extern shm_rpc_t *shm_rpc_open(void *ptr);
+
+/**
+ * @brief take a free caller slot, slot of a dead thread is taken again, thread safe
+ * @param rpc rpc channel
+ * @return slot, -1 if all slots are used
+ */
+extern int32_t shm_rpc_attach(shm_rpc_t *rpc);
+
+/**
+ * @brief give back caller slot
+ * @param rpc rpc channel
+ * @param slot slot from shm_rpc_attach
+ */
+extern void shm_rpc_detach(shm_rpc_t *rpc, int32_t slot);
+
+/**
+ * @brief send request and wait response, spin a while then park, one call a time per slot
+ * @param rpc rpc channel
+ * @param slot slot from shm_rpc_attach
+ * @param request request data
+ * @param len request length, <= msgsize
+ * @param response response buffer
+ * @param response_len in: buffer size, out: response length
+ * @param timeout_ms timeout in ms, SHM_WAIT_INFINITE for infinite
+ * @return 0 on success, ETIMEDOUT on timeout and the call is canceled, EMSGSIZE response
+ * truncated or request too long, EAGAIN request ring full or the push stalled too long,
+ * EOWNERDEAD the server died while serving it, EINVAL bad slot
+ */
+extern int shm_rpc_call(shm_rpc_t *rpc, int32_t slot, const void *request, int len,
+                        void *response, int *response_len, int timeout_ms);
+
+/**
+ * @brief take one request, spin a while then park, thread safe
+ * @param rpc rpc channel
+ * @param request out: request to reply
+ * @param buffer request data buffer
+ * @param len in: buffer size, >= msgsize, out: request length
+ * @param timeout_ms timeout in ms, SHM_WAIT_INFINITE for infinite
+ * @return 0 on success, ETIMEDOUT on timeout, EINVAL buffer too small
+ */
+extern int shm_rpc_recv(shm_rpc_t *rpc, shm_rpc_request_t *request, void *buffer, int *len, int timeout_ms);
+
+/**
+ * @brief send response and wake the caller, every request from shm_rpc_recv must be replied
+ * @param rpc rpc channel
+ * @param request request from shm_rpc_recv
+ * @param data response data
+ * @param len response length, <= msgsize
+ * @return 0 on success, ECANCELED caller timed out, EMSGSIZE too long and can reply again,
+ * EINVAL not a request being served
+ */
+extern int shm_rpc_reply(shm_rpc_t *rpc, const shm_rpc_request_t *request, const void *data, int len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,202 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shm_lock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief infinite timeout for wait functions
+ */
+#define SHM_WAIT_INFINITE -1
+
+/**
+ * @brief process shared event, auto or manual reset
+ */
+typedef struct {
+    uint32_t state;
+    uint32_t waiters;
+    uint32_t manual;
+    uint32_t reserve;
+} shm_event_t;
+
+/**
+ * @brief process shared counting semaphore
+ */
+typedef struct {
+    uint32_t value;
+    uint32_t waiters;
+} shm_sem_t;
+
+/**
+ * @brief process shared condition variable, used with shm_lock_t
+ */
+typedef struct {
+    uint32_t seq;
+    uint32_t waiters;
+} shm_cond_t;
+
+/**
+ * @brief state of shm_once_t, zero filled memory is SHM_ONCE_INIT
+ */
+enum {
+    SHM_ONCE_INIT = 0,
+    SHM_ONCE_INITIALIZING = 1,
+    SHM_ONCE_READY = 2,
+    SHM_ONCE_FAILED = 3,
+};
+
+/**
+ * @brief init once and readiness handshake between processes
+ */
+typedef struct {
+    uint32_t state;
+    uint32_t waiters;
+} shm_once_t;
+
+/**
+ * @brief process shared barrier
+ */
+typedef struct {
+    uint32_t word;      // generation << 16 | arrived
+    uint32_t count;
+} shm_barrier_t;
+
+#define SHM_BARRIER_SERIAL 1
+
+/**
+ * @brief try to become the initializer, from SHM_ONCE_INIT or SHM_ONCE_FAILED
+ * @param once the once pointer
+ * @return 1 caller must init and call shm_once_end, 0 others did or are doing it
+ */
+extern int shm_once_begin(shm_once_t *once);
+
+/**
+ * @brief force state to SHM_ONCE_INITIALIZING, for owner re-init a used segment
+ * @param once the once pointer
+ */
+extern void shm_once_reset(shm_once_t *once);
+
+/**
+ * @brief finish init and wake all waiters
+ * @param once the once pointer
+ * @param ok 1 SHM_ONCE_READY, 0 SHM_ONCE_FAILED
+ */
+extern void shm_once_end(shm_once_t *once, int ok);
+
+/**
+ * @brief wait until init finish
+ * @param once the once pointer
+ * @param timeout_ms timeout in ms, SHM_WAIT_INFINITE for infinite
+ * @return 0 ready, ECANCELED init failed, ETIMEDOUT on timeout
+ */
+extern int shm_once_wait(shm_once_t *once, int timeout_ms);
+
+/**
+ * @brief init barrier in shared memory
+ * @param barrier the barrier pointer
+ * @param count process count to wait, < 65536
+ * @return 0 on success, -1 on error
+ */
+extern int shm_barrier_create(shm_barrier_t *barrier, uint32_t count);
+
+/**
+ * @brief wait until count processes arrive
+ * @param barrier the barrier pointer
+ * @param timeout_ms timeout in ms, SHM_WAIT_INFINITE for infinite
+ * @return SHM_BARRIER_SERIAL for the last one, 0 for others, ETIMEDOUT on
+ * timeout and the caller is not counted
+ */
+extern int shm_barrier_wait(shm_barrier_t *barrier, int timeout_ms);
+
+/**
+ * @brief init event in shared memory
+ * @param event the event pointer
+ * @param manual 1 manual reset, 0 auto reset by a successful wait
+ * @param set initial state
+ */
+extern void shm_event_create(shm_event_t *event, int manual, int set);
+
+/**
+ * @brief set event, wake one waiter (auto) or all waiters (manual)
+ * @param event the event pointer
+ */
+extern void shm_event_set(shm_event_t *event);
+
+/**
+ * @brief reset event
+ * @param event the event pointer
+ */
+extern void shm_event_reset(shm_event_t *event);
+
+/**
+ * @brief wait event is set
+ * @param event the event pointer
+ * @param timeout_ms timeout in ms, SHM_WAIT_INFINITE for infinite
+ * @return 0 on success, ETIMEDOUT on timeout
+ */
+extern int shm_event_wait(shm_event_t *event, int timeout_ms);
+
+/**
+ * @brief init semaphore in shared memory
+ * @param sem the semaphore pointer
+ * @param value initial value
+ */
+extern void shm_sem_create(shm_sem_t *sem, uint32_t value);
+
+/**
+ * @brief add n to semaphore, wake waiters only if someone wait
+ * @param sem the semaphore pointer
+ * @param n count to post
+ */
+extern void shm_sem_post(shm_sem_t *sem, uint32_t n);
+
+/**
+ * @brief take one from semaphore without wait
+ * @param sem the semaphore pointer
+ * @return 0 on success, EAGAIN if value is 0
+ */
+extern int shm_sem_trywait(shm_sem_t *sem);
+
+/**
+ * @brief take one from semaphore
+ * @param sem the semaphore pointer
+ * @param timeout_ms timeout in ms, SHM_WAIT_INFINITE for infinite
+ * @return 0 on success, ETIMEDOUT on timeout
+ */
+extern int shm_sem_wait(shm_sem_t *sem, int timeout_ms);
+
+/**
+ * @brief init condition variable in shared memory
+ * @param cond the condition variable pointer
+ */
+extern void shm_cond_create(shm_cond_t *cond);
+
+/**
+ * @brief release lock, wait signal and acquire lock again
+ * @param cond the condition variable pointer
+ * @param lock the lock hold by caller
+ * @param timeout_ms timeout in ms, SHM_WAIT_INFINITE for infinite
+ * @return 0 on success, ETIMEDOUT on timeout, EOWNERDEAD see shm_lock_acquire,
+ * lock is hold in all cases
+ */
+extern int shm_cond_wait(shm_cond_t *cond, shm_lock_t *lock, int timeout_ms);
+
+/**
+ * @brief wake one waiter
+ * @param cond the condition variable pointer
+ */
+extern void shm_cond_signal(shm_cond_t *cond);
+
+/**
+ * @brief wake all waiters
+ * @param cond the condition variable pointer
+ */
+extern void shm_cond_broadcast(shm_cond_t *cond);
+
+#ifdef __cplusplus
+}
+#endif
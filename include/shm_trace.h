@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+
+#include "shm_container.h"
+#include "shm_lock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief custom instrumentation hooks, called only when the library is
+ * built with SHMUTIL_TRACE_HOOKS, NULL members are skipped
+ */
+typedef struct {
+    void (*pool_malloc)(shared_memory_pool_t *pool, int32_t offset);
+    void (*pool_malloc_fail)(shared_memory_pool_t *pool);
+    void (*pool_free)(shared_memory_pool_t *pool, int32_t offset);
+    void (*queue_put)(shared_queue_t *queue, int len);
+    void (*queue_full)(shared_queue_t *queue, int len);
+    void (*queue_get)(shared_queue_t *queue, int len);
+    void (*queue_shrink)(shared_queue_t *queue, int moved);     // called with queue lock hold
+    void (*lock_wait)(shm_lock_t *lock, uint64_t ns);           // time in acquire slow path
+} shm_trace_hooks_t;
+
+/**
+ * @brief set hooks of this process, hooks must stay valid until replaced
+ * @param hooks hook table, NULL to remove
+ * @return 0 on success, -1 if built without SHMUTIL_TRACE_HOOKS
+ */
+extern int shm_trace_set_hooks(const shm_trace_hooks_t *hooks);
+
+#ifdef __cplusplus
+}
+#endif
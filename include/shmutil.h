@@ -4,14 +4,57 @@
 #include <stdint.h>
 #include <pthread.h>
 
+#include "shm_lock.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief shared memory create/open flags
+ */
+enum {
+    SHM_FLAG_HUGETLB = 0x01,    // hugetlbfs backed, fall back to SHM_FLAG_THP
+    SHM_FLAG_THP = 0x02,        // madvise(MADV_HUGEPAGE) transparent huge page
+    SHM_FLAG_POPULATE = 0x04,   // mmap with MAP_POPULATE
+    SHM_FLAG_PREFAULT = 0x08,   // touch every page with several threads
+    SHM_FLAG_LOCK = 0x10,       // mlock whole segment
+    SHM_FLAG_SEAL = 0x20,       // seal size of anonymous shared memory
+    SHM_FLAG_GROWABLE = 0x40,   // keep shm_segment_t header, can grow online
+    SHM_FLAG_NUMA_INTERLEAVE = 0x80,    // interleave pages on all numa nodes
+    SHM_FLAG_RDONLY = 0x100,    // open read only, for inspecting tools
+};
+
+/**
+ * @brief numa memory policy
+ */
+enum {
+    SHM_NUMA_DEFAULT = 0,       // first touch
+    SHM_NUMA_PREFERRED = 1,     // prefer first node in mask, fall back to others
+    SHM_NUMA_BIND = 2,          // only nodes in mask
+    SHM_NUMA_INTERLEAVE = 3,    // round robin on nodes in mask
+};
+
+#define SHM_NUMA_ALL_NODES (~(uint64_t)0)
+
+/**
+ * @brief header of growable shared memory, user data start after it
+ */
+typedef struct {
+    uint32_t flag;
+    uint32_t generation;
+    uint64_t size;
+    shm_lock_t lock;    // serialize grow between processes
+    uint8_t reserve[40];
+} shm_segment_t;
+
 typedef struct shm_info_t_ {
     int fd;
     size_t size;
     void *ptr;
+    uint32_t flags;     // SHM_FLAG_* really applied
+    size_t pagesize;
+    uint32_t generation;
 } shm_info_t;
 
 /**
@@ -22,6 +65,15 @@ typedef struct shm_info_t_ {
  */
 extern shm_info_t *shared_memory_create(const char *name, size_t size);
 
+/**
+ * @brief create new shared memory with flags
+ * @param name name used by shm_open, or file name in hugetlbfs
+ * @param size shared memory size, round up to huge page size on hugetlbfs
+ * @param flags SHM_FLAG_*
+ * @return NULL for error
+ */
+extern shm_info_t *shared_memory_create_ex(const char *name, size_t size, uint32_t flags);
+
 /**
  * @brief open exist shared memory
  * @param name name used by shm_open
@@ -29,6 +81,107 @@ extern shm_info_t *shared_memory_create(const char *name, size_t size);
  */
 extern shm_info_t *shared_memory_open(const char *name);
 
+/**
+ * @brief open exist shared memory with flags
+ * @param name name used by shm_open, or file name in hugetlbfs
+ * @param flags SHM_FLAG_*
+ * @return NULL for error
+ */
+extern shm_info_t *shared_memory_open_ex(const char *name, uint32_t flags);
+
+/**
+ * @brief create anonymous shared memory by memfd_create, share it by fd
+ * @param name name for debug only, shown in /proc/self/fd
+ * @param size shared memory size
+ * @param flags SHM_FLAG_*, SHM_FLAG_HUGETLB use MFD_HUGETLB
+ * @return NULL for error
+ */
+extern shm_info_t *shared_memory_create_anon(const char *name, size_t size, uint32_t flags);
+
+/**
+ * @brief open shared memory from fd, eg: received by shared_memory_recv
+ * @param fd shared memory fd, owned by the result and closed with it
+ * @param flags SHM_FLAG_*
+ * @return NULL for error, fd is closed
+ */
+extern shm_info_t *shared_memory_open_fd(int fd, uint32_t flags);
+
+/**
+ * @brief send shared memory fd over unix socket with SCM_RIGHTS
+ * @param sock unix socket or socketpair
+ * @param info shared memory to send
+ * @return 0 on success, -1 on error
+ */
+extern int shared_memory_send(int sock, const shm_info_t *info);
+
+/**
+ * @brief receive shared memory sent by shared_memory_send and open it
+ * @param sock unix socket or socketpair
+ * @param flags SHM_FLAG_*
+ * @return NULL for error
+ */
+extern shm_info_t *shared_memory_recv(int sock, uint32_t flags);
+
+/**
+ * @brief get user data of shared memory, skip shm_segment_t if growable
+ * @param info create by shm_create/shm_open
+ * @return user data pointer
+ */
+static inline void *shared_memory_data(shm_info_t *info)
+{
+    if (info->flags & SHM_FLAG_GROWABLE)
+        return (uint8_t *)info->ptr + sizeof(shm_segment_t);
+    return info->ptr;
+}
+
+/**
+ * @brief grow growable shared memory and tell other processes to remap,
+ * any process can grow, concurrent grows are serialized by the segment lock
+ * pointer in the segment is invalid after grow, use offset instead
+ * @param info create with SHM_FLAG_GROWABLE
+ * @param size new size, smaller than current size is ignored
+ * @return 0 on success, -1 on error
+ */
+extern int shared_memory_grow(shm_info_t *info, size_t size);
+
+/**
+ * @brief remap growable shared memory if other process grow it,
+ * call it at a safe point where no pointer in the segment is held
+ * @param info create with SHM_FLAG_GROWABLE
+ * @return 1 remapped, 0 unchanged, -1 on error
+ */
+extern int shared_memory_remap(shm_info_t *info);
+
+/**
+ * @brief get numa node count, 1 on non-numa machine
+ * @return node count
+ */
+extern int shared_memory_numa_nodes();
+
+/**
+ * @brief get numa node of current cpu
+ * @return node id
+ */
+extern int shared_memory_numa_node();
+
+/**
+ * @brief set numa policy of memory range by mbind, before pages are touched
+ * @param ptr memory pointer, round down to page
+ * @param len memory length, round up to page
+ * @param mode SHM_NUMA_*
+ * @param nodemask bit N for node N, bits of absent nodes are ignored
+ * @return 0 on success, -1 on error
+ */
+extern int shared_memory_numa_bind(void *ptr, size_t len, int mode, uint64_t nodemask);
+
+/**
+ * @brief touch every page of shared memory, keep its content
+ * @param info create by shm_create/shm_open
+ * @param threads thread count, <= 0 to choose by size
+ * @return 0 on success, -1 on error
+ */
+extern int shared_memory_prefault(shm_info_t *info, int threads);
+
 /**
  * @brief close shared memory, shared memory still exist
  * @param info create by shm_create/shm_open
@@ -42,6 +195,21 @@ extern void shared_memory_close(shm_info_t *info);
  */
 extern int shared_memory_remove(const char *name);
 
+/**
+ * @brief create shared memory backed by a regular file
+ * @param path file path, on disk or tmpfs
+ * @param size file size
+ * @return NULL for error
+ */
+extern shm_info_t *shared_file_create(const char *path, size_t size);
+
+/**
+ * @brief open exist shared memory backed by a regular file
+ * @param path file path, on disk or tmpfs
+ * @return NULL for error
+ */
+extern shm_info_t *shared_file_open(const char *path);
+
 /**
  * @brief init phtread_mutex with PTHREAD_PROCESS_SHARED
  * @param mutex the mutex pointer
@@ -0,0 +1,253 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "shm_container.h"
+
+namespace shm {
+
+namespace detail {
+
+constexpr size_t align_up(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+constexpr size_t default_align(size_t align)
+{
+    return align > 8 ? align : 8;
+}
+
+} // namespace detail
+
+/**
+ * @brief typed view of shared_memory_pool_t holding N elements of T,
+ * layout is computed at compile time and is the same as
+ * shared_memory_pool_size(sizeof(T), N, Align)
+ */
+template <typename T, int32_t N, int32_t Align = int32_t(detail::default_align(alignof(T)))>
+class pool {
+    static_assert(N > 0, "pool must hold at least one element");
+    static_assert(Align > 0 && (Align & (Align - 1)) == 0, "Align must be 2^x");
+    static_assert(Align >= int32_t(alignof(T)), "Align must fit alignof(T)");
+
+public:
+    static constexpr int32_t elemsize = int32_t(detail::align_up(sizeof(T), Align));
+    static constexpr int32_t count = N;
+    static constexpr size_t datapos = detail::align_up(sizeof(shared_memory_pool_t) + sizeof(int32_t) * N, Align);
+    static constexpr size_t size = datapos + size_t(elemsize) * N;
+
+    /**
+     * @brief owner of one element, destroy and free it when going out of scope
+     */
+    class handle {
+    public:
+        handle() : pool_(nullptr), ptr_(nullptr) {}
+        handle(shared_memory_pool_t *pool, T *ptr) : pool_(pool), ptr_(ptr) {}
+        handle(handle &&o) : pool_(o.pool_), ptr_(o.ptr_) { o.ptr_ = nullptr; }
+        handle(const handle &) = delete;
+        ~handle() { reset(); }
+
+        handle &operator=(handle &&o)
+        {
+            if (this != &o) {
+                reset();
+                pool_ = o.pool_;
+                ptr_ = o.ptr_;
+                o.ptr_ = nullptr;
+            }
+            return *this;
+        }
+        handle &operator=(const handle &) = delete;
+
+        T *get() const { return ptr_; }
+        T &operator*() const { return *ptr_; }
+        T *operator->() const { return ptr_; }
+        explicit operator bool() const { return ptr_ != nullptr; }
+
+        /**
+         * @brief give up ownership, e.g. before sending the offset to another process
+         * @return offset in pool, -1 if empty
+         */
+        int32_t release()
+        {
+            int32_t off = ptr_ != nullptr ? pool::offset_of(pool_, ptr_) : -1;
+            ptr_ = nullptr;
+            return off;
+        }
+
+        void reset()
+        {
+            if (ptr_ != nullptr) {
+                ptr_->~T();
+                shared_memory_pool_free(pool_, ptr_);
+                ptr_ = nullptr;
+            }
+        }
+
+    private:
+        shared_memory_pool_t *pool_;
+        T *ptr_;
+    };
+
+    pool() : pool_(nullptr) {}
+
+    /**
+     * @brief create pool in shared memory
+     * @param ptr shared memory pointer, at least size bytes
+     */
+    static pool create(void *ptr) { return pool(shared_memory_pool_create(ptr, sizeof(T), N, Align)); }
+
+    /**
+     * @brief open exist pool, empty if layout is not the same
+     * @param ptr shared memory pointer
+     */
+    static pool open(void *ptr)
+    {
+        shared_memory_pool_t *p = shared_memory_pool_open(ptr);
+        if (p == nullptr || p->elemsize != elemsize || p->count != N ||
+            size_t(p->datapos) + sizeof(shared_memory_pool_t) != datapos)
+            return pool();
+        return pool(p);
+    }
+
+    explicit operator bool() const { return pool_ != nullptr; }
+    shared_memory_pool_t *raw() const { return pool_; }
+
+    /**
+     * @brief malloc and construct T in place
+     * @return empty handle if pool is full
+     */
+    template <typename... Args>
+    handle make(Args &&...args)
+    {
+        void *p = shared_memory_pool_malloc(pool_);
+        if (p == nullptr)
+            return handle();
+        return handle(pool_, new (p) T(std::forward<Args>(args)...));
+    }
+
+    /**
+     * @brief take ownership of an element by offset, e.g. received from another process
+     * @return empty handle if offset is out of range
+     */
+    handle adopt(int32_t offset) const { return handle(pool_, pointer(offset)); }
+
+    /**
+     * @brief destroy and free an element not owned by a handle
+     */
+    void destroy(T *ptr)
+    {
+        ptr->~T();
+        shared_memory_pool_free(pool_, ptr);
+    }
+
+    /**
+     * @brief offset of element, constant elemsize makes it a shift or a multiply
+     * @return offset in pool, -1 on fail
+     */
+    int32_t offset(const T *ptr) const { return offset_of(pool_, ptr); }
+
+    /**
+     * @brief pointer of offset without lock, does not check the element is in use
+     * @return nullptr if offset is out of range
+     */
+    T *pointer(int32_t offset) const
+    {
+        if (uint32_t(offset) >= uint32_t(N))
+            return nullptr;
+        return reinterpret_cast<T *>(base(pool_) + size_t(offset) * elemsize);
+    }
+
+private:
+    explicit pool(shared_memory_pool_t *p) : pool_(p) {}
+
+    static uint8_t *base(shared_memory_pool_t *p) { return reinterpret_cast<uint8_t *>(p) + datapos; }
+
+    static int32_t offset_of(shared_memory_pool_t *p, const T *ptr)
+    {
+        size_t df = reinterpret_cast<const uint8_t *>(ptr) - base(p);
+        if (df % elemsize != 0 || df / elemsize >= size_t(N))
+            return -1;
+        return int32_t(df / elemsize);
+    }
+
+    shared_memory_pool_t *pool_;
+};
+
+/**
+ * @brief view of shared_queue_t with N bytes buffer
+ */
+template <size_t N>
+class queue {
+    static_assert(N > sizeof(int), "queue buffer too small");
+
+public:
+    static constexpr size_t capacity = N;
+    static constexpr size_t size = sizeof(shared_queue_t) + N;
+
+    queue() : queue_(nullptr) {}
+
+    /**
+     * @brief create queue in shared memory
+     * @param ptr shared memory pointer, at least size bytes
+     */
+    static queue create(void *ptr) { return queue(shared_queue_create(ptr, N)); }
+
+    /**
+     * @brief open exist queue, empty if buffer size is not the same
+     * @param ptr shared memory pointer
+     */
+    static queue open(void *ptr)
+    {
+        shared_queue_t *q = shared_queue_open(ptr);
+        if (q == nullptr || q->size != N)
+            return queue();
+        return queue(q);
+    }
+
+    explicit operator bool() const { return queue_ != nullptr; }
+    shared_queue_t *raw() const { return queue_; }
+
+    /**
+     * @brief see shared_queue_put
+     */
+    int put(const void *data, int len) { return shared_queue_put(queue_, const_cast<void *>(data), len); }
+
+    /**
+     * @brief see shared_queue_get
+     */
+    int get(void *buffer, int len) { return shared_queue_get(queue_, buffer, len); }
+
+    /**
+     * @brief put a trivially copyable value
+     * @return false if queue is full
+     */
+    template <typename T>
+    bool push(const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable type can be copied");
+        return put(&value, sizeof(T)) > 0;
+    }
+
+    /**
+     * @brief get a trivially copyable value
+     * @return false if queue is empty or record size is not sizeof(T), the record is kept then
+     */
+    template <typename T>
+    bool pop(T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable type can be copied");
+        return shared_queue_get_exact(queue_, &value, sizeof(T)) == int(sizeof(T));
+    }
+
+private:
+    explicit queue(shared_queue_t *q) : queue_(q) {}
+
+    shared_queue_t *queue_;
+};
+
+} // namespace shm
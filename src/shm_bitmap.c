@@ -0,0 +1,118 @@
+#include <stdint.h>
+
+#include "shm_bitmap.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef int64_t (*bitmap_find_word_t)(const uint64_t *bitmap, int64_t from, int64_t nwords);
+
+static int64_t bitmap_find_word_scalar(const uint64_t *bitmap, int64_t from, int64_t nwords)
+{
+    for (int64_t i = from; i < nwords; i++) {
+        if (bitmap[i] != UINT64_MAX)
+            return i;
+    }
+    return nwords;
+}
+
+#if defined(__x86_64__)
+// compare 4 words a time, a full pool is skipped at 256 bits per loop
+__attribute__((target("avx2,bmi")))
+static int64_t bitmap_find_word_avx2(const uint64_t *bitmap, int64_t from, int64_t nwords)
+{
+    const __m256i full = _mm256_set1_epi64x(-1);
+    int64_t i = from;
+    for (; i + 4 <= nwords; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(bitmap + i));
+        uint32_t mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, full)));
+        if (mask != 0xf)
+            return i + _tzcnt_u32(~mask);
+    }
+    for (; i < nwords; i++) {
+        if (bitmap[i] != UINT64_MAX)
+            return i;
+    }
+    return nwords;
+}
+#endif
+
+static int64_t bitmap_find_word_select(const uint64_t *bitmap, int64_t from, int64_t nwords);
+
+// process local, the bitmap itself is shared by processes on different cpus
+static bitmap_find_word_t bitmap_find_word = bitmap_find_word_select;
+
+static int64_t bitmap_find_word_select(const uint64_t *bitmap, int64_t from, int64_t nwords)
+{
+    bitmap_find_word_t fn = bitmap_find_word_scalar;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi"))
+        fn = bitmap_find_word_avx2;
+#endif
+    __atomic_store_n(&bitmap_find_word, fn, __ATOMIC_RELAXED);
+    return fn(bitmap, from, nwords);
+}
+
+int64_t shm_bitmap_find_word(const uint64_t *bitmap, int64_t from, int64_t nwords)
+{
+    return __atomic_load_n(&bitmap_find_word, __ATOMIC_RELAXED)(bitmap, from, nwords);
+}
+
+int64_t shm_bitmap_find_run(const uint64_t *bitmap, int64_t from, int64_t nwords, int64_t n)
+{
+    int64_t nbits = nwords * 64;
+    int64_t run = 0;
+    int64_t i = from;
+    while (i < nbits) {
+        if (run == 0 && (i & 63) == 0) {
+            // skip full words before a run starts
+            i = shm_bitmap_find_word(bitmap, i >> 6, nwords) * 64;
+            if (i >= nbits)
+                break;
+        }
+        int shift = i & 63;
+        uint64_t word = bitmap[i >> 6] >> shift;
+        int avail = 64 - shift;
+        int len;
+        if (word & 1) {
+            // set bits end at first zero, bits shifted in from the top are zero
+            len = ~word == 0 ? 64 : __builtin_ctzll(~word);
+            run = 0;
+        } else {
+            len = word == 0 ? avail : __builtin_ctzll(word);
+            if (len > avail)
+                len = avail;
+            run += len;
+            if (run >= n)
+                return i + len - run;
+        }
+        i += len;
+    }
+    return -1;
+}
+
+void shm_bitmap_set(uint64_t *bitmap, int64_t from, int64_t n)
+{
+    while (n > 0) {
+        int shift = from & 63;
+        int len = n < 64 - shift ? n : 64 - shift;
+        uint64_t mask = (len == 64 ? UINT64_MAX : ((1ull << len) - 1)) << shift;
+        bitmap[from >> 6] |= mask;
+        from += len;
+        n -= len;
+    }
+}
+
+void shm_bitmap_clear(uint64_t *bitmap, int64_t from, int64_t n)
+{
+    while (n > 0) {
+        int shift = from & 63;
+        int len = n < 64 - shift ? n : 64 - shift;
+        uint64_t mask = (len == 64 ? UINT64_MAX : ((1ull << len) - 1)) << shift;
+        bitmap[from >> 6] &= ~mask;
+        from += len;
+        n -= len;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+
+// bit set means used, a bitmap is an array of uint64_t words
+
+/**
+ * @brief find first word with a clear bit, AVX2 or scalar picked at first call
+ * @param bitmap bitmap words
+ * @param from first word to look at
+ * @param nwords word count
+ * @return word index, nwords if all bits are set
+ */
+extern int64_t shm_bitmap_find_word(const uint64_t *bitmap, int64_t from, int64_t nwords);
+
+/**
+ * @brief find first run of n clear bits
+ * @param bitmap bitmap words
+ * @param from first bit to look at
+ * @param nwords word count
+ * @param n run length
+ * @return first bit of run, -1 if not found
+ */
+extern int64_t shm_bitmap_find_run(const uint64_t *bitmap, int64_t from, int64_t nwords, int64_t n);
+
+/**
+ * @brief set n bits from bit from
+ */
+extern void shm_bitmap_set(uint64_t *bitmap, int64_t from, int64_t n);
+
+/**
+ * @brief clear n bits from bit from
+ */
+extern void shm_bitmap_clear(uint64_t *bitmap, int64_t from, int64_t n);
+
+static inline int shm_bitmap_test(const uint64_t *bitmap, int64_t bit)
+{
+    return (bitmap[bit >> 6] >> (bit & 63)) & 1;
+}
@@ -1,11 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "shmutil.h"
 #include "shm_container.h"
+#include "shm_probe.h"
+#include "shm_bitmap.h"
 
 #define POOL_FLAG_END -1
 #define POOL_FLAG_USING -2
 
+// pool hold the lock for a few instructions, spin longer before park
+#define POOL_LOCK_SPIN 1000
+
+#define POOL_LAYOUT_MASK (SHM_POOL_INTRUSIVE | SHM_POOL_BITMAP | SHM_POOL_COLOR)
+
+// default layout keep the old flag, others use a new one old code rejects
+#define POOL_FLAG 0xa1a20306
+#define POOL_FLAG_LAYOUT 0xa1a20307
+
+static int pool_layout_valid(uint32_t layout)
+{
+    if ((layout & ~POOL_LAYOUT_MASK) != 0)
+        return 0;
+    return !((layout & SHM_POOL_INTRUSIVE) && (layout & SHM_POOL_BITMAP));
+}
+
+#define POOL_CACHE_LINE 64
+
 static int32_t align_size(int32_t size, int32_t align)
 {
     // align must be 2^x
@@ -14,34 +38,173 @@ static int32_t align_size(int32_t size, int32_t align)
     return align * ((size + (align - 1)) / align);
 }
 
-static int32_t shared_memory_datapos(int32_t count, int32_t align)
+static int32_t pool_elemsize(int32_t elemsize, int32_t align, uint32_t flags)
+{
+    if (align > 1)
+        elemsize = align_size(elemsize, align);
+    // free element hold the next index
+    if ((flags & SHM_POOL_INTRUSIVE) && elemsize > 0 && elemsize < (int32_t)sizeof(int32_t))
+        elemsize = sizeof(int32_t);
+    // odd count of cache lines, consecutive elements start at different sets
+    if ((flags & SHM_POOL_COLOR) && align <= POOL_CACHE_LINE && elemsize >= 2 * POOL_CACHE_LINE &&
+        elemsize < INT32_MAX - 2 * POOL_CACHE_LINE) {
+        elemsize = align_size(elemsize, POOL_CACHE_LINE);
+        if ((elemsize / POOL_CACHE_LINE) % 2 == 0)
+            elemsize += POOL_CACHE_LINE;
+    }
+    return elemsize;
+}
+
+static int64_t pool_nwords(int32_t count)
+{
+    return ((int64_t)count + 63) / 64;
+}
+
+// int32_t meta[count], or one in use bit per element for SHM_POOL_INTRUSIVE,
+// or in use bits and continuation bits of multi element runs for SHM_POOL_BITMAP
+static size_t shared_memory_datapos(int32_t count, int32_t align, uint32_t flags)
 {
-    return align_size(sizeof(shared_memory_pool_t) + sizeof(int32_t) * count, align);
+    size_t meta = sizeof(int32_t) * (size_t)count;
+    if (flags & SHM_POOL_INTRUSIVE)
+        meta = sizeof(uint64_t) * pool_nwords(count);
+    else if (flags & SHM_POOL_BITMAP)
+        meta = sizeof(uint64_t) * pool_nwords(count) * 2;
+    return align_size(sizeof(shared_memory_pool_t) + meta, align);
+}
+
+static uint8_t *shared_memory_pool_element(shared_memory_pool_t *pool, int32_t offset)
+{
+    return pool->data + pool->datapos + (size_t)offset * pool->elemsize;
+}
+
+static uint64_t *pool_bitmap(shared_memory_pool_t *pool)
+{
+    return (uint64_t *)pool->data;
+}
+
+// bit set on every element of a run but the first
+static uint64_t *pool_cont(shared_memory_pool_t *pool)
+{
+    return (uint64_t *)pool->data + pool_nwords(pool->count);
+}
+
+// element may be unaligned with align 1
+static int32_t pool_next_get(const uint8_t *elem)
+{
+    int32_t next;
+    memcpy(&next, elem, sizeof(next));
+    return next;
+}
+
+static void pool_next_set(uint8_t *elem, int32_t next)
+{
+    memcpy(elem, &next, sizeof(next));
+}
+
+// keep runs starting with a set in use bit, the tail of a run half way in
+// malloc_n or free has no head and is free again
+static void pool_bitmap_repair(shared_memory_pool_t *pool)
+{
+    uint64_t *used = pool_bitmap(pool);
+    uint64_t *cont = pool_cont(pool);
+    int32_t use_count = 0;
+    int in_run = 0;
+    for (int32_t i = 0; i < pool->count; i++) {
+        if (!shm_bitmap_test(used, i))
+            in_run = 0;
+        else if (!shm_bitmap_test(cont, i))
+            in_run = 1;
+        if (in_run) {
+            use_count++;
+        } else {
+            shm_bitmap_clear(used, i, 1);
+            shm_bitmap_clear(cont, i, 1);
+        }
+    }
+    pool->first = 0;
+    pool->use_count = use_count;
+}
+
+// rebuild free list after owner died in malloc/free, an element half
+// way in malloc is not marked using and is free again
+static void shared_memory_pool_repair(shared_memory_pool_t *pool)
+{
+    if (pool->layout & SHM_POOL_BITMAP) {
+        pool_bitmap_repair(pool);
+        return;
+    }
+    int32_t *meta = (int32_t *)pool->data;
+    uint64_t *bitmap = pool_bitmap(pool);
+    int32_t first = POOL_FLAG_END;
+    int32_t use_count = 0;
+    for (int32_t i = pool->count - 1; i >= 0; i--) {
+        if (pool->layout & SHM_POOL_INTRUSIVE) {
+            if (shm_bitmap_test(bitmap, i)) {
+                use_count++;
+                continue;
+            }
+            pool_next_set(shared_memory_pool_element(pool, i), first);
+        } else if (meta[i] == POOL_FLAG_USING) {
+            use_count++;
+            continue;
+        } else {
+            meta[i] = first;
+        }
+        first = i;
+    }
+    pool->first = first;
+    pool->use_count = use_count;
+}
+
+static void shared_memory_pool_lock(shared_memory_pool_t *pool)
+{
+    if (shm_lock_acquire(&pool->mutex) == EOWNERDEAD)
+        shared_memory_pool_repair(pool);
+}
+
+// inverse of odd d modulo 2^64, newton iteration double the correct bits
+static uint64_t pool_inverse(uint64_t d)
+{
+    uint64_t x = d;     // d * d == 1 mod 8
+    for (int i = 0; i < 5; i++)
+        x *= 2 - d * x;
+    return x;
 }
 
 size_t shared_memory_pool_size(int32_t elemsize, int32_t count, int32_t align)
 {
-    if (align > 1)
-        elemsize = align_size(elemsize, align);
-    return shared_memory_datapos(count, align) + elemsize * count;
+    return shared_memory_pool_size_ex(elemsize, count, align, 0);
+}
+
+size_t shared_memory_pool_size_ex(int32_t elemsize, int32_t count, int32_t align, uint32_t flags)
+{
+    elemsize = pool_elemsize(elemsize, align, flags);
+    return shared_memory_datapos(count, align, flags) + (size_t)elemsize * count;
 }
 
 shared_memory_pool_t *shared_memory_pool_create(void *ptr, int32_t elemsize, int32_t count, int32_t align)
 {
-    if (align > 1)
-        elemsize = align_size(elemsize, align);
-    if (elemsize < 0)
+    return shared_memory_pool_create_ex(ptr, elemsize, count, align, 0);
+}
+
+shared_memory_pool_t *shared_memory_pool_create_ex(void *ptr, int32_t elemsize, int32_t count, int32_t align,
+                                                   uint32_t flags)
+{
+    elemsize = pool_elemsize(elemsize, align, flags);
+    if (elemsize <= 0 || count <= 0 || !pool_layout_valid(flags))
         return NULL;
 
     shared_memory_pool_t *pool = ptr;
     pool->elemsize = elemsize;
     pool->count = count;
     pool->use_count = 0;
+    pool->shift = __builtin_ctz(elemsize);
+    pool->layout = flags;
+    pool->inverse = pool_inverse((uint32_t)elemsize >> pool->shift);
 
-    if (pthread_spin_init(&pool->mutex, PTHREAD_PROCESS_SHARED) != 0)
-        return NULL;
-    pool->flag = 0xa1a20304;
-    pool->datapos = shared_memory_datapos(count, align) - sizeof(shared_memory_pool_t);
+    shm_lock_create(&pool->mutex, POOL_LOCK_SPIN);
+    pool->flag = flags != 0 ? POOL_FLAG_LAYOUT : POOL_FLAG;
+    pool->datapos = shared_memory_datapos(count, align, flags) - sizeof(shared_memory_pool_t);
     shared_memory_pool_clear(pool);
     return pool;
 }
@@ -49,76 +212,608 @@ shared_memory_pool_t *shared_memory_pool_create(void *ptr, int32_t elemsize, int
 shared_memory_pool_t *shared_memory_pool_open(void *ptr)
 {
     shared_memory_pool_t *pool = ptr;
-    if (pool->flag != 0xa1a20304)
-        return NULL;
-    return pool;
+    if (pool->flag == POOL_FLAG && pool->layout == 0)
+        return pool;
+    if (pool->flag == POOL_FLAG_LAYOUT && pool->layout != 0 && pool_layout_valid(pool->layout))
+        return pool;
+    return NULL;
 }
 
 void shared_memory_pool_clear(shared_memory_pool_t *pool)
 {
-    pthread_spin_lock(&pool->mutex);
-    int32_t *meta = (int32_t *)pool->data;
+    shared_memory_pool_lock(pool);
     pool->first = 0;
-    for (int32_t i = 0; i < pool->count - 1; i++) {
-        meta[i] = i + 1;
+    if (pool->layout & SHM_POOL_BITMAP) {
+        int64_t nwords = pool_nwords(pool->count);
+        memset(pool_bitmap(pool), 0, sizeof(uint64_t) * nwords * 2);
+        // bits past count are never free
+        shm_bitmap_set(pool_bitmap(pool), pool->count, nwords * 64 - pool->count);
+    } else if (pool->layout & SHM_POOL_INTRUSIVE) {
+        memset(pool_bitmap(pool), 0, sizeof(uint64_t) * pool_nwords(pool->count));
+        for (int32_t i = 0; i < pool->count - 1; i++)
+            pool_next_set(shared_memory_pool_element(pool, i), i + 1);
+        pool_next_set(shared_memory_pool_element(pool, pool->count - 1), POOL_FLAG_END);
+    } else {
+        int32_t *meta = (int32_t *)pool->data;
+        for (int32_t i = 0; i < pool->count - 1; i++) {
+            meta[i] = i + 1;
+        }
+        meta[pool->count - 1] = POOL_FLAG_END;
     }
-    meta[pool->count - 1] = POOL_FLAG_END;
     pool->use_count = 0;
-    pthread_spin_unlock(&pool->mutex);
+    shm_lock_release(&pool->mutex);
 }
 
 void *shared_memory_pool_malloc(shared_memory_pool_t *pool)
 {
-    void *p = NULL;
-    pthread_spin_lock(&pool->mutex);
-    int32_t *meta = (int32_t *)pool->data;
+    if (pool->layout & SHM_POOL_BITMAP)
+        return shared_memory_pool_malloc_n(pool, 1);
+
+    uint8_t *p = NULL;
+    int32_t offset = -1;
+    shared_memory_pool_lock(pool);
     if (pool->first >= 0) {
-        int offset = pool->first;
-        pool->first = meta[offset];
-        meta[offset] = POOL_FLAG_USING;
-        p = pool->data + pool->datapos + offset * pool->elemsize;
+        offset = pool->first;
+        p = shared_memory_pool_element(pool, offset);
+        if (pool->layout & SHM_POOL_INTRUSIVE) {
+            // the element is about to be used, its line is the one we want warm
+            pool->first = pool_next_get(p);
+            pool_bitmap(pool)[offset >> 6] |= 1ull << (offset & 63);
+        } else {
+            int32_t *meta = (int32_t *)pool->data;
+            pool->first = meta[offset];
+            meta[offset] = POOL_FLAG_USING;
+        }
         pool->use_count++;
     }
-    pthread_spin_unlock(&pool->mutex);
+    shm_lock_release(&pool->mutex);
+
+    if (p == NULL)
+        SHM_TRACE1(pool_malloc_fail, pool);
+    else
+        SHM_TRACE2(pool_malloc, pool, offset);
     return p;
 }
 
+void *shared_memory_pool_malloc_n(shared_memory_pool_t *pool, int32_t n)
+{
+    if (!(pool->layout & SHM_POOL_BITMAP))
+        return n == 1 ? shared_memory_pool_malloc(pool) : NULL;
+    if (n <= 0 || n > pool->count)
+        return NULL;
+
+    uint8_t *p = NULL;
+    int64_t offset = -1;
+    shared_memory_pool_lock(pool);
+    uint64_t *used = pool_bitmap(pool);
+    int64_t nwords = pool_nwords(pool->count);
+    // words before first are full
+    if (n == 1) {
+        int64_t word = shm_bitmap_find_word(used, pool->first, nwords);
+        if (word < nwords) {
+            offset = word * 64 + __builtin_ctzll(~used[word]);
+            pool->first = word;
+        }
+    } else {
+        offset = shm_bitmap_find_run(used, (int64_t)pool->first * 64, nwords, n);
+    }
+    if (offset >= 0) {
+        // head bit last, repair frees a run without head
+        uint64_t *cont = pool_cont(pool);
+        shm_bitmap_clear(cont, offset, 1);
+        shm_bitmap_set(cont, offset + 1, n - 1);
+        shm_bitmap_set(used, offset + 1, n - 1);
+        shm_bitmap_set(used, offset, 1);
+        pool->use_count += n;
+        p = shared_memory_pool_element(pool, offset);
+    }
+    shm_lock_release(&pool->mutex);
+
+    if (p == NULL)
+        SHM_TRACE1(pool_malloc_fail, pool);
+    else
+        SHM_TRACE2(pool_malloc, pool, offset);
+    return p;
+}
+
+// release the run starting at offset, return element count, 0 if not a run head
+static int32_t pool_bitmap_free(shared_memory_pool_t *pool, int32_t offset)
+{
+    uint64_t *used = pool_bitmap(pool);
+    uint64_t *cont = pool_cont(pool);
+    if (!shm_bitmap_test(used, offset) || shm_bitmap_test(cont, offset))
+        return 0;
+    int32_t n = 1;
+    while (offset + n < pool->count && shm_bitmap_test(cont, offset + n))
+        n++;
+    // head bit first, see malloc_n
+    shm_bitmap_clear(used, offset, 1);
+    shm_bitmap_clear(used, offset + 1, n - 1);
+    shm_bitmap_clear(cont, offset + 1, n - 1);
+    if ((offset >> 6) < pool->first)
+        pool->first = offset >> 6;
+    return n;
+}
+
 void shared_memory_pool_free(shared_memory_pool_t *pool, void *ptr)
 {
     int offset = shared_memory_pool_offset(pool, ptr);
     if (offset < 0)
         return;
 
-    pthread_spin_lock(&pool->mutex);
-    int32_t *meta = (int32_t *)pool->data;
-    meta[offset]= pool->first;
+    shared_memory_pool_lock(pool);
+    if (pool->layout & SHM_POOL_BITMAP) {
+        int32_t n = pool_bitmap_free(pool, offset);
+        pool->use_count -= n;
+        shm_lock_release(&pool->mutex);
+        if (n > 0)
+            SHM_TRACE2(pool_free, pool, offset);
+        return;
+    }
+    if (pool->layout & SHM_POOL_INTRUSIVE) {
+        uint64_t *word = &pool_bitmap(pool)[offset >> 6];
+        // double free would make a cycle in the free list
+        if (!(*word & (1ull << (offset & 63)))) {
+            shm_lock_release(&pool->mutex);
+            return;
+        }
+        *word &= ~(1ull << (offset & 63));
+        pool_next_set(ptr, pool->first);
+    } else {
+        int32_t *meta = (int32_t *)pool->data;
+        meta[offset]= pool->first;
+    }
     pool->first = offset;
     pool->use_count--;
-    pthread_spin_unlock(&pool->mutex);
+    shm_lock_release(&pool->mutex);
+    SHM_TRACE2(pool_free, pool, offset);
 }
 
-int32_t shared_memory_pool_offset(shared_memory_pool_t *pool, void *ptr)
+void *shared_memory_pool_pointer(shared_memory_pool_t *pool, int32_t offset)
 {
-    int32_t df = (uint8_t *)ptr - pool->data - pool->datapos;
-    if (df % pool->elemsize != 0)
-        return -1;
-    int32_t offset = df / pool->elemsize;
+    void *ptr = NULL;
     if (offset < 0 || offset >= pool->count)
+        return ptr;
+
+    shared_memory_pool_lock(pool);
+    int in_use;
+    if (pool->layout & SHM_POOL_BITMAP)
+        in_use = shm_bitmap_test(pool_bitmap(pool), offset) && !shm_bitmap_test(pool_cont(pool), offset);
+    else if (pool->layout & SHM_POOL_INTRUSIVE)
+        in_use = shm_bitmap_test(pool_bitmap(pool), offset);
+    else
+        in_use = ((int32_t *)pool->data)[offset] == POOL_FLAG_USING;
+    if (in_use)
+        ptr = shared_memory_pool_element(pool, offset);
+    shm_lock_release(&pool->mutex);
+    return ptr;
+}
+
+void shared_memory_pool_stat(const shared_memory_pool_t *pool, shared_memory_pool_stat_t *stat)
+{
+    stat->elemsize = pool->elemsize;
+    stat->count = __atomic_load_n(&pool->count, __ATOMIC_RELAXED);
+    stat->use_count = __atomic_load_n(&pool->use_count, __ATOMIC_RELAXED);
+    stat->layout = pool->layout;
+    uint32_t state = __atomic_load_n(&pool->mutex.state, __ATOMIC_RELAXED);
+    stat->lock_owner = state & SHM_LOCK_TID_MASK;
+    stat->lock_waiters = (state & SHM_LOCK_WAITERS) != 0;
+
+    if (pool->layout & SHM_POOL_BITMAP) {
+        // bits past count are set
+        const uint64_t *used = (const uint64_t *)pool->data;
+        int64_t nwords = pool_nwords(stat->count);
+        int64_t n = 0;
+        for (int64_t i = 0; i < nwords; i++)
+            n += __builtin_popcountll(__atomic_load_n(&used[i], __ATOMIC_RELAXED));
+        stat->free_count = nwords * 64 - n;
+        return;
+    }
+
+    // walk at most count steps, a cycle or bad index means it is changing
+    const int32_t *meta = (const int32_t *)pool->data;
+    const uint8_t *base = pool->data + pool->datapos;
+    int32_t offset = __atomic_load_n(&pool->first, __ATOMIC_RELAXED);
+    int32_t n = 0;
+    while (offset >= 0 && offset < stat->count && n <= stat->count) {
+        if (pool->layout & SHM_POOL_INTRUSIVE)
+            offset = pool_next_get(base + (size_t)offset * stat->elemsize);
+        else
+            offset = __atomic_load_n(&meta[offset], __ATOMIC_RELAXED);
+        n++;
+    }
+    stat->free_count = (offset == POOL_FLAG_END && n <= stat->count) ? n : -1;
+}
+
+#define SHARD_INDEX_MASK ((1 << SHM_SHARD_INDEX_BITS) - 1)
+#define SHARD_MAX_SHARDS (1 << (31 - SHM_SHARD_INDEX_BITS))
+
+static uint64_t shard_page_align(uint64_t size)
+{
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+size_t shared_memory_shard_size(int32_t elemsize, int32_t count, int32_t nshards, int32_t align)
+{
+    if (nshards <= 0)
+        nshards = shared_memory_numa_nodes();
+    if (count > INT32_MAX / nshards)
+        return 0;
+    // every shard start at page boundary to be bound to its own node
+    return shard_page_align(sizeof(shared_memory_shard_t)) +
+           shard_page_align(shared_memory_pool_size(elemsize, count, align)) * nshards;
+}
+
+shared_memory_shard_t *shared_memory_shard_create(void *ptr, int32_t elemsize, int32_t count,
+                                                  int32_t nshards, int32_t align)
+{
+    int nodes = shared_memory_numa_nodes();
+    if (nshards <= 0)
+        nshards = nodes;
+    if (nshards > SHARD_MAX_SHARDS || count <= 0 || count > SHARD_INDEX_MASK + 1)
+        return NULL;
+    // total count is int32
+    if (count > INT32_MAX / nshards)
+        return NULL;
+
+    shared_memory_shard_t *shard = ptr;
+    shard->shard_count = count;
+    shard->nshards = nshards;
+    shard->datapos = shard_page_align(sizeof(shared_memory_shard_t));
+    shard->shard_size = shard_page_align(shared_memory_pool_size(elemsize, count, align));
+
+    for (int32_t i = 0; i < nshards; i++) {
+        uint8_t *p = (uint8_t *)shard + shard->datapos + shard->shard_size * i;
+        // best effort, memory policy is only a hint for placement
+        shared_memory_numa_bind(p, shard->shard_size, SHM_NUMA_PREFERRED, 1ull << (i % nodes));
+        shared_memory_pool_t *pool = shared_memory_pool_create(p, elemsize, count, align);
+        if (pool == NULL)
+            return NULL;
+        shard->elemsize = pool->elemsize;
+    }
+    shard->count = count * nshards;
+    shard->flag = 0xa1a20334;
+    return shard;
+}
+
+shared_memory_shard_t *shared_memory_shard_open(void *ptr)
+{
+    shared_memory_shard_t *shard = ptr;
+    if (shard->flag != 0xa1a20334)
+        return NULL;
+    return shard;
+}
+
+shared_memory_pool_t *shared_memory_shard_pool(shared_memory_shard_t *shard, int32_t index)
+{
+    if (index < 0 || index >= shard->nshards)
+        return NULL;
+    return (shared_memory_pool_t *)((uint8_t *)shard + shard->datapos + shard->shard_size * index);
+}
+
+void *shared_memory_shard_malloc(shared_memory_shard_t *shard)
+{
+    int32_t local = shared_memory_numa_node() % shard->nshards;
+    for (int32_t i = 0; i < shard->nshards; i++) {
+        shared_memory_pool_t *pool = shared_memory_shard_pool(shard, (local + i) % shard->nshards);
+        if (pool->use_count >= pool->count)
+            continue;
+        void *p = shared_memory_pool_malloc(pool);
+        if (p != NULL)
+            return p;
+    }
+    return NULL;
+}
+
+static int32_t shard_index(shared_memory_shard_t *shard, void *ptr)
+{
+    uint8_t *base = (uint8_t *)shard + shard->datapos;
+    if ((uint8_t *)ptr < base)
         return -1;
-    return offset;
+    uint64_t index = ((uint8_t *)ptr - base) / shard->shard_size;
+    if (index >= (uint64_t)shard->nshards)
+        return -1;
+    return index;
 }
 
-void *shared_memory_pool_pointer(shared_memory_pool_t *pool, int32_t offset)
+void shared_memory_shard_free(shared_memory_shard_t *shard, void *ptr)
 {
-    void *ptr = NULL;
-    if (offset < 0 || offset >= pool->count)
-        return ptr;
+    int32_t index = shard_index(shard, ptr);
+    if (index < 0)
+        return;
+    shared_memory_pool_free(shared_memory_shard_pool(shard, index), ptr);
+}
 
-    pthread_spin_lock(&pool->mutex);
-    int32_t *meta = (int32_t *)pool->data;
-    if (meta[offset] == POOL_FLAG_USING)
-        ptr = pool->data + pool->datapos + offset * pool->elemsize;
-    pthread_spin_unlock(&pool->mutex);
+int32_t shared_memory_shard_offset(shared_memory_shard_t *shard, void *ptr)
+{
+    int32_t index = shard_index(shard, ptr);
+    if (index < 0)
+        return -1;
+    int32_t offset = shared_memory_pool_offset(shared_memory_shard_pool(shard, index), ptr);
+    if (offset < 0)
+        return -1;
+    return (index << SHM_SHARD_INDEX_BITS) | offset;
+}
+
+void *shared_memory_shard_pointer(shared_memory_shard_t *shard, int32_t offset)
+{
+    if (offset < 0)
+        return NULL;
+    shared_memory_pool_t *pool = shared_memory_shard_pool(shard, offset >> SHM_SHARD_INDEX_BITS);
+    if (pool == NULL)
+        return NULL;
+    return shared_memory_pool_pointer(pool, offset & SHARD_INDEX_MASK);
+}
+
+#define CHAIN_INDEX_MASK ((1 << SHM_CHAIN_INDEX_BITS) - 1)
+#define CHAIN_MAX_CHUNKS (1 << (31 - SHM_CHAIN_INDEX_BITS))
+
+// chunk layout: int32_t meta[chunk_count], aligned elements
+static int32_t chain_datapos(shared_memory_chain_header_t *header)
+{
+    return align_size(sizeof(int32_t) * header->chunk_count, header->align);
+}
+
+static size_t chain_chunk_size(shared_memory_chain_header_t *header)
+{
+    return chain_datapos(header) + (size_t)header->elemsize * header->chunk_count;
+}
+
+static int chain_chunk_name(shared_memory_chain_header_t *header, int32_t chunk, char *buffer, size_t size)
+{
+    int r = snprintf(buffer, size, "%s.%d", header->name, chunk);
+    if (r < 0 || (size_t)r >= size)
+        return -1;
+    return 0;
+}
+
+static shared_memory_chain_t *chain_malloc(shared_memory_chain_header_t *header)
+{
+    shared_memory_chain_t *chain = malloc(sizeof(shared_memory_chain_t));
+    if (chain == NULL)
+        return NULL;
+    chain->chunks = calloc(header->max_chunks, sizeof(shm_info_t *));
+    if (chain->chunks == NULL) {
+        free(chain);
+        return NULL;
+    }
+    chain->header = header;
+    pthread_mutex_init(&chain->mutex, NULL);
+    return chain;
+}
+
+// map chunk in this process, open it if created by other process
+static uint8_t *chain_chunk(shared_memory_chain_t *chain, int32_t chunk)
+{
+    shared_memory_chain_header_t *header = chain->header;
+    if (chunk < 0 || chunk >= __atomic_load_n(&header->nchunks, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    shm_info_t *info = __atomic_load_n(&chain->chunks[chunk], __ATOMIC_ACQUIRE);
+    if (info != NULL)
+        return info->ptr;
+
+    char name[96];
+    pthread_mutex_lock(&chain->mutex);
+    info = chain->chunks[chunk];
+    if (info == NULL && chain_chunk_name(header, chunk, name, sizeof(name)) == 0) {
+        info = shared_memory_open(name);
+        if (info != NULL && info->size < chain_chunk_size(header)) {
+            shared_memory_close(info);
+            info = NULL;
+        }
+        __atomic_store_n(&chain->chunks[chunk], info, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&chain->mutex);
+    return info != NULL ? info->ptr : NULL;
+}
+
+// create next chunk and link its elements to free list, under header mutex
+static int chain_grow(shared_memory_chain_t *chain)
+{
+    char name[96];
+    shared_memory_chain_header_t *header = chain->header;
+    int32_t chunk = header->nchunks;
+    if (chunk >= header->max_chunks)
+        return -1;
+    if (chain_chunk_name(header, chunk, name, sizeof(name)) != 0)
+        return -1;
+
+    shm_info_t *info = shared_memory_create(name, chain_chunk_size(header));
+    if (info == NULL)
+        return -1;
+
+    int32_t *meta = info->ptr;
+    int32_t base = chunk << SHM_CHAIN_INDEX_BITS;
+    for (int32_t i = 0; i < header->chunk_count - 1; i++)
+        meta[i] = base + i + 1;
+    meta[header->chunk_count - 1] = header->first;
+
+    pthread_mutex_lock(&chain->mutex);
+    if (chain->chunks[chunk] != NULL)
+        shared_memory_close(chain->chunks[chunk]);
+    __atomic_store_n(&chain->chunks[chunk], info, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&chain->mutex);
+
+    header->count += header->chunk_count;
+    __atomic_store_n(&header->nchunks, chunk + 1, __ATOMIC_RELEASE);
+    header->first = base;
+    return 0;
+}
+
+// rebuild free list of published chunks after owner died, a chunk created
+// but not published is created again by next grow
+static void chain_repair(shared_memory_chain_t *chain)
+{
+    shared_memory_chain_header_t *header = chain->header;
+    int32_t first = POOL_FLAG_END;
+    int32_t use_count = 0;
+    for (int32_t chunk = header->nchunks - 1; chunk >= 0; chunk--) {
+        int32_t *meta = (int32_t *)chain_chunk(chain, chunk);
+        if (meta == NULL)
+            continue;
+        int32_t base = chunk << SHM_CHAIN_INDEX_BITS;
+        for (int32_t i = header->chunk_count - 1; i >= 0; i--) {
+            if (meta[i] == POOL_FLAG_USING) {
+                use_count++;
+                continue;
+            }
+            meta[i] = first;
+            first = base + i;
+        }
+    }
+    header->first = first;
+    header->count = header->nchunks * header->chunk_count;
+    header->use_count = use_count;
+}
+
+static void chain_lock(shared_memory_chain_t *chain)
+{
+    if (shm_lock_acquire(&chain->header->mutex) == EOWNERDEAD)
+        chain_repair(chain);
+}
+
+size_t shared_memory_chain_size()
+{
+    return sizeof(shared_memory_chain_header_t);
+}
+
+shared_memory_chain_t *shared_memory_chain_create(void *ptr, const char *name, int32_t elemsize,
+                                                  int32_t chunk_count, int32_t max_chunks, int32_t align)
+{
+    if (align < 1 || (align & (align - 1)) != 0)
+        return NULL;
+    elemsize = align_size(elemsize, align);
+    if (elemsize <= 0 || chunk_count <= 0 || chunk_count > CHAIN_INDEX_MASK + 1)
+        return NULL;
+    if (max_chunks <= 0 || max_chunks > CHAIN_MAX_CHUNKS)
+        return NULL;
+    if (strlen(name) >= sizeof(((shared_memory_chain_header_t *)0)->name))
+        return NULL;
+
+    shared_memory_chain_header_t *header = ptr;
+    header->elemsize = elemsize;
+    header->count = 0;
+    header->use_count = 0;
+    header->chunk_count = chunk_count;
+    header->max_chunks = max_chunks;
+    header->align = align;
+    header->nchunks = 0;
+    header->first = POOL_FLAG_END;
+    strcpy(header->name, name);
+    shm_lock_create(&header->mutex, SHM_LOCK_DEFAULT_SPIN);
+    header->flag = 0xa1a20325;
+
+    return chain_malloc(header);
+}
+
+shared_memory_chain_t *shared_memory_chain_open(void *ptr)
+{
+    shared_memory_chain_header_t *header = ptr;
+    if (header->flag != 0xa1a20325)
+        return NULL;
+    return chain_malloc(header);
+}
+
+void shared_memory_chain_close(shared_memory_chain_t *chain)
+{
+    for (int32_t i = 0; i < chain->header->max_chunks; i++) {
+        if (chain->chunks[i] != NULL)
+            shared_memory_close(chain->chunks[i]);
+    }
+    pthread_mutex_destroy(&chain->mutex);
+    free(chain->chunks);
+    free(chain);
+}
+
+void shared_memory_chain_remove(shared_memory_chain_t *chain)
+{
+    char name[96];
+    int32_t nchunks = __atomic_load_n(&chain->header->nchunks, __ATOMIC_ACQUIRE);
+    for (int32_t i = 0; i < nchunks; i++) {
+        if (chain_chunk_name(chain->header, i, name, sizeof(name)) == 0)
+            shared_memory_remove(name);
+    }
+}
+
+void *shared_memory_chain_malloc(shared_memory_chain_t *chain)
+{
+    void *p = NULL;
+    shared_memory_chain_header_t *header = chain->header;
+    chain_lock(chain);
+    if (header->first < 0)
+        chain_grow(chain);
+    if (header->first >= 0) {
+        int32_t handle = header->first;
+        int32_t index = handle & CHAIN_INDEX_MASK;
+        uint8_t *base = chain_chunk(chain, handle >> SHM_CHAIN_INDEX_BITS);
+        if (base != NULL) {
+            int32_t *meta = (int32_t *)base;
+            header->first = meta[index];
+            meta[index] = POOL_FLAG_USING;
+            p = base + chain_datapos(header) + (size_t)index * header->elemsize;
+            header->use_count++;
+        }
+    }
+    shm_lock_release(&header->mutex);
+    return p;
+}
+
+void shared_memory_chain_free(shared_memory_chain_t *chain, void *ptr)
+{
+    int32_t handle = shared_memory_chain_offset(chain, ptr);
+    if (handle < 0)
+        return;
+
+    shared_memory_chain_header_t *header = chain->header;
+    int32_t *meta = (int32_t *)chain_chunk(chain, handle >> SHM_CHAIN_INDEX_BITS);
+    int32_t index = handle & CHAIN_INDEX_MASK;
+    chain_lock(chain);
+    if (meta[index] == POOL_FLAG_USING) {
+        meta[index] = header->first;
+        header->first = handle;
+        header->use_count--;
+    }
+    shm_lock_release(&header->mutex);
+}
+
+int32_t shared_memory_chain_offset(shared_memory_chain_t *chain, void *ptr)
+{
+    shared_memory_chain_header_t *header = chain->header;
+    int32_t nchunks = __atomic_load_n(&header->nchunks, __ATOMIC_ACQUIRE);
+    for (int32_t i = 0; i < nchunks; i++) {
+        shm_info_t *info = __atomic_load_n(&chain->chunks[i], __ATOMIC_ACQUIRE);
+        if (info == NULL)
+            continue;
+
+        uint8_t *data = (uint8_t *)info->ptr + chain_datapos(header);
+        if ((uint8_t *)ptr < data || (uint8_t *)ptr >= data + (size_t)header->elemsize * header->chunk_count)
+            continue;
+        size_t df = (uint8_t *)ptr - data;
+        if (df % header->elemsize != 0)
+            return -1;
+        return (i << SHM_CHAIN_INDEX_BITS) | (int32_t)(df / header->elemsize);
+    }
+    return -1;
+}
+
+void *shared_memory_chain_pointer(shared_memory_chain_t *chain, int32_t offset)
+{
+    shared_memory_chain_header_t *header = chain->header;
+    int32_t index = offset & CHAIN_INDEX_MASK;
+    if (offset < 0 || index >= header->chunk_count)
+        return NULL;
+    uint8_t *base = chain_chunk(chain, offset >> SHM_CHAIN_INDEX_BITS);
+    if (base == NULL)
+        return NULL;
+
+    void *ptr = NULL;
+    int32_t *meta = (int32_t *)base;
+    chain_lock(chain);
+    if (meta[index] == POOL_FLAG_USING)
+        ptr = base + chain_datapos(header) + (size_t)index * header->elemsize;
+    shm_lock_release(&header->mutex);
     return ptr;
 }
 
@@ -132,11 +827,11 @@ shared_queue_t *shared_queue_create(void *ptr, size_t size)
     shared_queue_t *queue = ptr;
     queue->size = size;
 
-    if (shm_lock_init(&queue->mutex) != 0)
-        return NULL;
-    queue->flag = 0xa1a21314;
+    shm_lock_create(&queue->mutex, SHM_LOCK_DEFAULT_SPIN);
     queue->readpos = 0;
     queue->writepos = 0;
+    queue->shrinking = 0;
+    queue->flag = 0xa1a21316;
 
     return queue;
 }
@@ -144,19 +839,52 @@ shared_queue_t *shared_queue_create(void *ptr, size_t size)
 shared_queue_t *shared_queue_open(void *ptr)
 {
     shared_queue_t *queue = ptr;
-    if (queue->flag != 0xa1a21314)
+    if (queue->flag != 0xa1a21316)
         return NULL;
     return queue;
 }
 
+// check records from readpos after owner died in put/get, keep the valid
+// ones and drop the rest, a half done shrink left overlapped records so
+// the queue is emptied
+static void shared_queue_repair(shared_queue_t *queue)
+{
+    if (queue->shrinking || queue->readpos < 0 || queue->readpos > queue->writepos ||
+        queue->writepos > queue->size) {
+        queue->readpos = 0;
+        queue->writepos = 0;
+        __atomic_store_n(&queue->shrinking, 0, __ATOMIC_RELEASE);
+        return;
+    }
+
+    int pos = queue->readpos;
+    while (pos + (int)sizeof(int) <= queue->writepos) {
+        int hlen;
+        memcpy(&hlen, queue->data + pos, sizeof(int));
+        if (hlen < 0 || hlen > queue->writepos - pos - (int)sizeof(int))
+            break;
+        pos += sizeof(int) + hlen;
+    }
+    queue->writepos = pos;
+}
+
+static void shared_queue_lock(shared_queue_t *queue)
+{
+    if (shm_lock_acquire(&queue->mutex) == EOWNERDEAD)
+        shared_queue_repair(queue);
+}
+
 static int shared_queue_shrink(shared_queue_t *queue, int len)
 {
     if (queue->readpos > 0) {
+        __atomic_store_n(&queue->shrinking, 1, __ATOMIC_RELEASE);
         if (queue->writepos > queue->readpos) {
             memmove(queue->data, queue->data + queue->readpos, queue->writepos - queue->readpos);
+            SHM_TRACE2(queue_shrink, queue, queue->writepos - queue->readpos);
         }
         queue->writepos -= queue->readpos;
         queue->readpos = 0;
+        __atomic_store_n(&queue->shrinking, 0, __ATOMIC_RELEASE);
     }
 
     if (queue->writepos + len > queue->size)
@@ -166,46 +894,84 @@ static int shared_queue_shrink(shared_queue_t *queue, int len)
 
 int shared_queue_put(shared_queue_t *queue, void *data, int len)
 {
-    pthread_mutex_lock(&queue->mutex);
+    shared_queue_lock(queue);
 
     int tlen = len + sizeof(int);
     if (queue->writepos + tlen > queue->size) {
         if (shared_queue_shrink(queue, tlen) != 0) {
-            pthread_mutex_unlock(&queue->mutex);
+            shm_lock_release(&queue->mutex);
+            SHM_TRACE2(queue_full, queue, len);
             return 0;
         }
     }
 
+    // move writepos once, a dead putter leave no partial record
     memcpy(queue->data + queue->writepos, &len, sizeof(int));
-    queue->writepos += sizeof(int);
-    memcpy(queue->data + queue->writepos, data, len);
-    queue->writepos += len;
+    memcpy(queue->data + queue->writepos + sizeof(int), data, len);
+    queue->writepos += tlen;
 
-    pthread_mutex_unlock(&queue->mutex);
+    shm_lock_release(&queue->mutex);
+    SHM_TRACE2(queue_put, queue, len);
     return len;
 }
 
-int shared_queue_get(shared_queue_t *queue, void *buffer, int len)
+// exact only take a record of len, others are left in the queue
+static int shared_queue_take(shared_queue_t *queue, void *buffer, int len, int exact)
 {
-    pthread_mutex_lock(&queue->mutex);
+    shared_queue_lock(queue);
 
     int sz = queue->writepos - queue->readpos;
     if (sz <= 0) {
-        pthread_mutex_unlock(&queue->mutex);
+        shm_lock_release(&queue->mutex);
         return 0;
     }
 
     int hlen;
     memcpy(&hlen, queue->data + queue->readpos, sizeof(int));
-    if (hlen > len) {
-        pthread_mutex_unlock(&queue->mutex);
+    if (hlen > len || (exact && hlen != len)) {
+        shm_lock_release(&queue->mutex);
         return -1;
     }
-    queue->readpos += sizeof(int);
-
-    memcpy(buffer, queue->data + queue->readpos, hlen);
-    queue->readpos += hlen;
+    memcpy(buffer, queue->data + queue->readpos + sizeof(int), hlen);
+    queue->readpos += sizeof(int) + hlen;
 
-    pthread_mutex_unlock(&queue->mutex);
+    shm_lock_release(&queue->mutex);
+    SHM_TRACE2(queue_get, queue, hlen);
     return hlen;
 }
+
+int shared_queue_get(shared_queue_t *queue, void *buffer, int len)
+{
+    return shared_queue_take(queue, buffer, len, 0);
+}
+
+int shared_queue_get_exact(shared_queue_t *queue, void *buffer, int len)
+{
+    return shared_queue_take(queue, buffer, len, 1);
+}
+
+void shared_queue_stat(const shared_queue_t *queue, shared_queue_stat_t *stat)
+{
+    stat->size = queue->size;
+    stat->readpos = __atomic_load_n(&queue->readpos, __ATOMIC_RELAXED);
+    stat->writepos = __atomic_load_n(&queue->writepos, __ATOMIC_RELAXED);
+    uint32_t state = __atomic_load_n(&queue->mutex.state, __ATOMIC_RELAXED);
+    stat->lock_owner = state & SHM_LOCK_TID_MASK;
+    stat->lock_waiters = (state & SHM_LOCK_WAITERS) != 0;
+
+    stat->records = -1;
+    if (stat->readpos < 0 || stat->readpos > stat->writepos || (size_t)stat->writepos > stat->size)
+        return;
+    int pos = stat->readpos;
+    int records = 0;
+    while (pos + (int)sizeof(int) <= stat->writepos) {
+        int hlen;
+        memcpy(&hlen, queue->data + pos, sizeof(int));
+        if (hlen < 0 || hlen > stat->writepos - pos - (int)sizeof(int))
+            return;
+        pos += sizeof(int) + hlen;
+        records++;
+    }
+    if (pos == stat->writepos)
+        stat->records = records;
+}
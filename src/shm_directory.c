@@ -0,0 +1,191 @@
+#include <string.h>
+
+#include "shmutil.h"
+#include "shm_directory.h"
+
+#define DIRECTORY_FLAG 0xa1a26162
+
+static uint32_t directory_hash(const char *name)
+{
+    // FNV-1a, 0 is reserved for empty entry
+    uint32_t h = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)name; *p != '\0'; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h == 0 ? 1 : h;
+}
+
+static uint64_t directory_align(uint64_t size, uint64_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+// find entry of name, or the empty entry to insert it
+static shared_directory_entry_t *directory_lookup(shared_directory_t *dir, const char *name, uint32_t hash)
+{
+    uint32_t mask = dir->capacity - 1;
+    for (uint32_t i = 0; i <= mask; i++) {
+        shared_directory_entry_t *e = &dir->entries[(hash + i) & mask];
+        // hash is published last, entry is complete once it is set
+        uint32_t h = __atomic_load_n(&e->hash, __ATOMIC_ACQUIRE);
+        if (h == 0)
+            return e;
+        if (h == hash && strncmp(e->name, name, SHM_OBJECT_NAME_SIZE) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+static uint64_t directory_first(int32_t capacity)
+{
+    return directory_align(sizeof(shared_directory_t) + sizeof(shared_directory_entry_t) * capacity, 64);
+}
+
+// owner died in alloc, an entry without hash is not published and is reused,
+// top and count are recomputed from the published ones
+static void directory_repair(shared_directory_t *dir)
+{
+    uint64_t top = directory_first(dir->capacity);
+    int32_t count = 0;
+    for (int32_t i = 0; i < dir->capacity; i++) {
+        shared_directory_entry_t *e = &dir->entries[i];
+        if (e->hash == 0)
+            continue;
+        if (e->offset + e->size > top)
+            top = e->offset + e->size;
+        count++;
+    }
+    dir->top = top;
+    dir->count = count;
+}
+
+static void directory_lock(shared_directory_t *dir)
+{
+    if (shm_lock_acquire(&dir->mutex) == EOWNERDEAD)
+        directory_repair(dir);
+}
+
+shared_directory_t *shared_directory_create(void *ptr, size_t size, int32_t capacity)
+{
+    if (capacity <= 0)
+        return NULL;
+    int32_t cap = 1;
+    while (cap < capacity)
+        cap <<= 1;
+
+    uint64_t top = directory_first(cap);
+    if (top > size)
+        return NULL;
+
+    shared_directory_t *dir = ptr;
+    // the segment may be reused, stop attachers until shared_directory_ready
+    shm_once_reset(&dir->ready);
+    __atomic_store_n(&dir->flag, 0, __ATOMIC_RELEASE);
+    dir->size = size;
+    dir->capacity = cap;
+    dir->count = 0;
+    dir->top = top;
+    memset(dir->entries, 0, sizeof(shared_directory_entry_t) * cap);
+    shm_lock_create(&dir->mutex, SHM_LOCK_DEFAULT_SPIN);
+    __atomic_store_n(&dir->flag, DIRECTORY_FLAG, __ATOMIC_RELEASE);
+    return dir;
+}
+
+shared_directory_t *shared_directory_open(void *ptr)
+{
+    shared_directory_t *dir = ptr;
+    if (__atomic_load_n(&dir->flag, __ATOMIC_ACQUIRE) != DIRECTORY_FLAG)
+        return NULL;
+    return dir;
+}
+
+void shared_directory_ready(shared_directory_t *dir, int ok)
+{
+    shm_once_end(&dir->ready, ok);
+}
+
+shared_directory_t *shared_directory_wait(void *ptr, int timeout_ms)
+{
+    shared_directory_t *dir = ptr;
+    if (shm_once_wait(&dir->ready, timeout_ms) != 0)
+        return NULL;
+    return shared_directory_open(ptr);
+}
+
+void *shared_directory_alloc(shared_directory_t *dir, const char *name, uint32_t type, uint32_t version,
+                             size_t size, size_t align)
+{
+    if (strlen(name) >= SHM_OBJECT_NAME_SIZE || align == 0 || (align & (align - 1)) != 0)
+        return NULL;
+
+    void *ptr = NULL;
+    uint32_t hash = directory_hash(name);
+    directory_lock(dir);
+
+    shared_directory_entry_t *e = directory_lookup(dir, name, hash);
+    uint64_t offset = directory_align(dir->top, align);
+    if (e != NULL && e->hash == 0 && offset <= dir->size && size <= dir->size - offset) {
+        strcpy(e->name, name);
+        e->type = type;
+        e->version = version;
+        e->offset = offset;
+        e->size = size;
+        __atomic_store_n(&e->hash, hash, __ATOMIC_RELEASE);
+        dir->top = offset + size;
+        dir->count++;
+        ptr = (uint8_t *)dir + offset;
+    }
+
+    shm_lock_release(&dir->mutex);
+    return ptr;
+}
+
+void *shared_directory_find(shared_directory_t *dir, const char *name, uint32_t type, uint32_t version,
+                            size_t *size)
+{
+    shared_directory_entry_t *e = directory_lookup(dir, name, directory_hash(name));
+    if (e == NULL || e->hash == 0)
+        return NULL;
+    if (e->type != type || e->version != version)
+        return NULL;
+    if (size != NULL)
+        *size = e->size;
+    return (uint8_t *)dir + e->offset;
+}
+
+shared_memory_pool_t *shared_directory_pool_create(shared_directory_t *dir, const char *name,
+                                                   int32_t elemsize, int32_t count, int32_t align)
+{
+    size_t size = shared_memory_pool_size(elemsize, count, align);
+    void *ptr = shared_directory_alloc(dir, name, SHM_OBJECT_POOL, SHM_OBJECT_POOL_VERSION, size,
+                                       align > 8 ? align : 8);
+    if (ptr == NULL)
+        return NULL;
+    return shared_memory_pool_create(ptr, elemsize, count, align);
+}
+
+shared_memory_pool_t *shared_directory_pool_open(shared_directory_t *dir, const char *name)
+{
+    void *ptr = shared_directory_find(dir, name, SHM_OBJECT_POOL, SHM_OBJECT_POOL_VERSION, NULL);
+    if (ptr == NULL)
+        return NULL;
+    return shared_memory_pool_open(ptr);
+}
+
+shared_queue_t *shared_directory_queue_create(shared_directory_t *dir, const char *name, size_t size)
+{
+    void *ptr = shared_directory_alloc(dir, name, SHM_OBJECT_QUEUE, SHM_OBJECT_QUEUE_VERSION,
+                                       shared_queue_size(size), 8);
+    if (ptr == NULL)
+        return NULL;
+    return shared_queue_create(ptr, size);
+}
+
+shared_queue_t *shared_directory_queue_open(shared_directory_t *dir, const char *name)
+{
+    void *ptr = shared_directory_find(dir, name, SHM_OBJECT_QUEUE, SHM_OBJECT_QUEUE_VERSION, NULL);
+    if (ptr == NULL)
+        return NULL;
+    return shared_queue_open(ptr);
+}
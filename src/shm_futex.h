@@ -0,0 +1,78 @@
+#pragma once
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// futex word lives in shared memory, never use FUTEX_PRIVATE_FLAG
+
+/**
+ * @brief sleep while *addr == val
+ * @param timeout relative timeout, NULL for infinite
+ * @return 0 on wake up, -1 with errno EAGAIN/EINTR/ETIMEDOUT
+ */
+static inline int futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+/**
+ * @brief wake up to n waiters on addr
+ * @return waiters woken up
+ */
+static inline int futex_wake(uint32_t *addr, int n)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0);
+}
+
+/**
+ * @brief absolute CLOCK_MONOTONIC deadline timeout_ms from now
+ */
+static inline void futex_deadline(int timeout_ms, struct timespec *deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * @brief sleep while *addr == val until deadline
+ * @param deadline from futex_deadline, NULL for infinite
+ * @return 0 on wake up or spurious wake up, ETIMEDOUT after deadline
+ */
+static inline int futex_wait_until(uint32_t *addr, uint32_t val, const struct timespec *deadline)
+{
+    if (deadline == NULL) {
+        futex_wait(addr, val, NULL);
+        return 0;
+    }
+
+    struct timespec now, rel;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rel.tv_sec = deadline->tv_sec - now.tv_sec;
+    rel.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (rel.tv_nsec < 0) {
+        rel.tv_sec--;
+        rel.tv_nsec += 1000000000L;
+    }
+    if (rel.tv_sec < 0)
+        return ETIMEDOUT;
+    if (futex_wait(addr, val, &rel) != 0 && errno == ETIMEDOUT)
+        return ETIMEDOUT;
+    return 0;
+}
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shm_lock.h"
+#include "shm_futex.h"
+#include "shm_probe.h"
+
+__thread uint32_t shm_lock_tid_cache = 0;
+
+static void lock_atfork_child()
+{
+    // child has a new tid
+    shm_lock_tid_cache = 0;
+}
+
+static void lock_atfork_register()
+{
+    pthread_atfork(NULL, NULL, lock_atfork_child);
+}
+
+uint32_t shm_lock_tid_slow()
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, lock_atfork_register);
+    shm_lock_tid_cache = syscall(SYS_gettid) & SHM_LOCK_TID_MASK;
+    return shm_lock_tid_cache;
+}
+
+int shm_lock_owner_dead(uint32_t tid)
+{
+    int saved = errno;
+    if (kill(tid, 0) != 0 && errno == ESRCH) {
+        errno = saved;
+        return 1;
+    }
+
+    // an exited process keep its pid until reaped, state after comm is Z or X
+    char buf[512];
+    int dead = 0;
+    snprintf(buf, sizeof(buf), "/proc/%u/stat", tid);
+    int fd = open(buf, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        dead = errno == ENOENT;
+    } else {
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n > 0) {
+            buf[n] = 0;
+            char *p = strrchr(buf, ')');
+            dead = p != NULL && p[1] == ' ' && (p[2] == 'Z' || p[2] == 'X');
+        }
+    }
+    errno = saved;
+    return dead;
+}
+
+void shm_lock_create(shm_lock_t *lock, uint32_t spin)
+{
+    lock->spin = spin;
+    __atomic_store_n(&lock->state, 0, __ATOMIC_RELEASE);
+}
+
+static int lock_acquire_wait(shm_lock_t *lock)
+{
+    uint32_t self = shm_lock_self();
+    uint32_t spin = lock->spin;
+    for (uint32_t i = 0; i < spin; i++) {
+        cpu_relax();
+        if (__atomic_load_n(&lock->state, __ATOMIC_RELAXED) == 0 && shm_lock_tryacquire(lock))
+            return 0;
+    }
+
+    struct timespec timeout = {SHM_LOCK_CHECK_MS / 1000, (SHM_LOCK_CHECK_MS % 1000) * 1000000};
+    while (1) {
+        uint32_t c = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if (c == 0) {
+            // others may be parked, keep waiters bit for release to wake them
+            if (__atomic_compare_exchange_n(&lock->state, &c, self | SHM_LOCK_WAITERS, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return 0;
+            continue;
+        }
+
+        if (shm_lock_owner_dead(c & SHM_LOCK_TID_MASK)) {
+            if (__atomic_compare_exchange_n(&lock->state, &c, self | (c & SHM_LOCK_WAITERS), 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return EOWNERDEAD;
+            continue;
+        }
+
+        if (!(c & SHM_LOCK_WAITERS)) {
+            if (!__atomic_compare_exchange_n(&lock->state, &c, c | SHM_LOCK_WAITERS, 0,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                continue;
+            c |= SHM_LOCK_WAITERS;
+        }
+        futex_wait(&lock->state, c, &timeout);
+    }
+}
+
+int shm_lock_acquire_slow(shm_lock_t *lock)
+{
+    // begin/end probes let the tracer measure wait time without a clock here
+    SHM_PROBE1(lock_wait_begin, lock);
+#ifdef SHMUTIL_TRACE_HOOKS
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+    int r = lock_acquire_wait(lock);
+    SHM_PROBE2(lock_wait_end, lock, r);
+#ifdef SHMUTIL_TRACE_HOOKS
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    SHM_HOOK(lock_wait, lock, (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec);
+#endif
+    return r;
+}
+
+void shm_lock_release_slow(shm_lock_t *lock)
+{
+    futex_wake(&lock->state, 1);
+}
+
+// writer: 0 free, 1 writer hold or pending, 2 and someone parked on it
+#define RWLOCK_FLAG 0xa1a27170
+
+size_t shm_rwlock_size(uint32_t nslots)
+{
+    if (nslots == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_CONF);
+        nslots = cpus > 0 ? cpus : 1;
+    }
+    return sizeof(shm_rwlock_t) + sizeof(shm_rwlock_slot_t) * nslots;
+}
+
+shm_rwlock_t *shm_rwlock_create(void *ptr, uint32_t nslots)
+{
+    shm_rwlock_t *lock = ptr;
+    lock->nslots = (shm_rwlock_size(nslots) - sizeof(shm_rwlock_t)) / sizeof(shm_rwlock_slot_t);
+    lock->spin = SHM_LOCK_DEFAULT_SPIN;
+    lock->writer = 0;
+    for (uint32_t i = 0; i < lock->nslots; i++)
+        lock->slots[i].count = 0;
+    __atomic_store_n(&lock->flag, RWLOCK_FLAG, __ATOMIC_RELEASE);
+    return lock;
+}
+
+shm_rwlock_t *shm_rwlock_open(void *ptr)
+{
+    shm_rwlock_t *lock = ptr;
+    if (__atomic_load_n(&lock->flag, __ATOMIC_ACQUIRE) != RWLOCK_FLAG)
+        return NULL;
+    return lock;
+}
+
+// wait until writer word is 0, mark it so that unlock wake us
+static void rwlock_wait_writer(shm_rwlock_t *lock)
+{
+    for (uint32_t i = 0; i < lock->spin; i++) {
+        if (__atomic_load_n(&lock->writer, __ATOMIC_RELAXED) == 0)
+            return;
+        cpu_relax();
+    }
+    uint32_t w;
+    while ((w = __atomic_load_n(&lock->writer, __ATOMIC_RELAXED)) != 0) {
+        if (w == 1 && !__atomic_compare_exchange_n(&lock->writer, &w, 2, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            continue;
+        futex_wait(&lock->writer, 2, NULL);
+    }
+}
+
+uint32_t shm_rwlock_rdlock(shm_rwlock_t *lock)
+{
+    int cpu = sched_getcpu();
+    uint32_t slot = (cpu >= 0 ? (uint32_t)cpu : shm_lock_self()) % lock->nslots;
+    uint32_t *count = &lock->slots[slot].count;
+
+    while (1) {
+        // pairs with writer: set writer then read counts, both seq_cst
+        __atomic_fetch_add(count, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&lock->writer, __ATOMIC_SEQ_CST) == 0)
+            return slot;
+
+        // writer pending, back off and let it drain
+        if (__atomic_sub_fetch(count, 1, __ATOMIC_SEQ_CST) == 0)
+            futex_wake(count, 1);
+        rwlock_wait_writer(lock);
+    }
+}
+
+void shm_rwlock_rdunlock(shm_rwlock_t *lock, uint32_t slot)
+{
+    uint32_t *count = &lock->slots[slot].count;
+    if (__atomic_sub_fetch(count, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&lock->writer, __ATOMIC_SEQ_CST) != 0)
+        futex_wake(count, 1);
+}
+
+void shm_rwlock_wrlock(shm_rwlock_t *lock)
+{
+    // writers exclude each other on the writer word
+    uint32_t w = 0;
+    while (!__atomic_compare_exchange_n(&lock->writer, &w, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        rwlock_wait_writer(lock);
+        w = 0;
+    }
+
+    for (uint32_t i = 0; i < lock->nslots; i++) {
+        uint32_t *count = &lock->slots[i].count;
+        uint32_t spin = lock->spin;
+        uint32_t c;
+        while ((c = __atomic_load_n(count, __ATOMIC_SEQ_CST)) != 0) {
+            if (spin > 0) {
+                spin--;
+                cpu_relax();
+                continue;
+            }
+            futex_wait(count, c, NULL);
+        }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+void shm_rwlock_wrunlock(shm_rwlock_t *lock)
+{
+    if (__atomic_exchange_n(&lock->writer, 0, __ATOMIC_RELEASE) == 2)
+        futex_wake(&lock->writer, INT32_MAX);
+}
@@ -0,0 +1,392 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "shm_log.h"
+
+#define LOG_FLAG 0xa1a24153
+#define LOG_RECORD_DATA 0xa1a24151
+#define LOG_RECORD_PAD 0xa1a24152
+
+typedef struct {
+    uint32_t len;
+    uint32_t flag;
+    uint8_t data[0];
+} shm_log_record_t;
+
+static uint64_t log_record_size(uint32_t len)
+{
+    return (sizeof(shm_log_record_t) + (uint64_t)len + 7) & ~(uint64_t)7;
+}
+
+static int log_segment_path(shm_log_t *log, uint32_t seg, char *buffer, size_t size)
+{
+    int r = snprintf(buffer, size, "%s.%u", log->path, seg);
+    if (r < 0 || (size_t)r >= size)
+        return -1;
+    return 0;
+}
+
+static int log_msync(void *ptr, size_t len, int flags)
+{
+    // msync address must be page aligned
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)ptr & ~(page - 1);
+    return msync((void *)start, (uintptr_t)ptr + len - start, flags);
+}
+
+// lock word of a header written before reboot holds a tid of another
+// boot, which may be a live unrelated thread now
+static uint64_t log_boot_id()
+{
+    static uint64_t boot = 0;
+    if (boot != 0)
+        return boot;
+
+    uint64_t id = 1;
+    FILE *fp = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (fp != NULL) {
+        int c;
+        while ((c = fgetc(fp)) != EOF)
+            id = id * 131 + c;
+        fclose(fp);
+    }
+    boot = id != 0 ? id : 1;
+    return boot;
+}
+
+// first process of a new boot reset the lock, others wait for it
+static void log_boot_check(shm_log_header_t *header)
+{
+    uint64_t boot = log_boot_id();
+    uint64_t old = __atomic_load_n(&header->boot, __ATOMIC_ACQUIRE);
+    while (old != boot) {
+        if (old != 0 && __atomic_compare_exchange_n(&header->boot, &old, 0, 0, __ATOMIC_ACQUIRE,
+                                                    __ATOMIC_ACQUIRE)) {
+            shm_lock_create(&header->mutex, SHM_LOCK_DEFAULT_SPIN);
+            __atomic_store_n(&header->boot, boot, __ATOMIC_RELEASE);
+            return;
+        }
+        if (old == 0)
+            usleep(1000);
+        old = __atomic_load_n(&header->boot, __ATOMIC_ACQUIRE);
+    }
+}
+
+static shm_log_t *log_malloc(const char *path)
+{
+    shm_log_t *log = calloc(1, sizeof(shm_log_t));
+    if (log == NULL)
+        return NULL;
+    log->path = strdup(path);
+    if (log->path == NULL) {
+        free(log);
+        return NULL;
+    }
+    pthread_mutex_init(&log->mutex, NULL);
+    return log;
+}
+
+// map segment in this process, create the file if needed
+static uint8_t *log_segment(shm_log_t *log, uint32_t seg, int create)
+{
+    uint8_t *ptr = NULL;
+    char path[4096];
+
+    pthread_mutex_lock(&log->mutex);
+    if (seg >= log->nsegs) {
+        uint32_t n = log->nsegs ? log->nsegs : 16;
+        while (n <= seg)
+            n *= 2;
+        shm_info_t **segs = realloc(log->segs, sizeof(shm_info_t *) * n);
+        if (segs == NULL)
+            goto out;
+        memset(segs + log->nsegs, 0, sizeof(shm_info_t *) * (n - log->nsegs));
+        log->segs = segs;
+        log->nsegs = n;
+    }
+
+    if (log->segs[seg] == NULL) {
+        if (log_segment_path(log, seg, path, sizeof(path)) != 0)
+            goto out;
+        if (create)
+            log->segs[seg] = shared_file_create(path, log->header->segsize);
+        else
+            log->segs[seg] = shared_file_open(path);
+        if (log->segs[seg] == NULL)
+            goto out;
+        if (log->segs[seg]->size < log->header->segsize) {
+            shared_memory_close(log->segs[seg]);
+            log->segs[seg] = NULL;
+            goto out;
+        }
+    }
+    ptr = log->segs[seg]->ptr;
+
+out:
+    pthread_mutex_unlock(&log->mutex);
+    return ptr;
+}
+
+// remove segment files left by a trim whose owner died, they are below head
+static void log_repair(shm_log_t *log)
+{
+    char path[4096];
+    for (uint64_t seg = log->header->head / log->header->segsize; seg > 0; seg--) {
+        if (log_segment_path(log, seg - 1, path, sizeof(path)) != 0 || unlink(path) != 0)
+            break;
+    }
+}
+
+static void log_lock(shm_log_t *log)
+{
+    // tail is published after the record is written, only a trim can be half done
+    if (shm_lock_acquire(&log->header->mutex) == EOWNERDEAD)
+        log_repair(log);
+}
+
+static void log_unlock(shm_log_t *log)
+{
+    shm_lock_release(&log->header->mutex);
+}
+
+shm_log_t *shm_log_create(const char *path, uint64_t segsize, uint32_t sync)
+{
+    // segment must hold at least one record header and a padding header
+    if (segsize < 2 * sizeof(shm_log_record_t) || segsize % 8 != 0)
+        return NULL;
+    if (sync > SHM_LOG_SYNC_RECORD)
+        return NULL;
+
+    // old segment files would be taken as new ones
+    char seg_path[4096];
+    shm_log_remove(path);
+    for (uint32_t i = 0;; i++) {
+        int r = snprintf(seg_path, sizeof(seg_path), "%s.%u", path, i);
+        if (r < 0 || (size_t)r >= sizeof(seg_path) || unlink(seg_path) != 0)
+            break;
+    }
+
+    shm_log_t *log = log_malloc(path);
+    if (log == NULL)
+        return NULL;
+
+    log->info = shared_file_create(path, sizeof(shm_log_header_t));
+    if (log->info == NULL)
+        goto err;
+
+    shm_log_header_t *header = log->info->ptr;
+    header->segsize = segsize;
+    header->head = 0;
+    header->tail = 0;
+    header->sync = sync;
+    shm_lock_create(&header->mutex, SHM_LOCK_DEFAULT_SPIN);
+    header->boot = log_boot_id();
+    header->flag = LOG_FLAG;
+    log->header = header;
+
+    if (sync != SHM_LOG_SYNC_NONE && msync(header, sizeof(shm_log_header_t), MS_SYNC) != 0)
+        goto err;
+    return log;
+
+err:
+    shm_log_close(log);
+    return NULL;
+}
+
+shm_log_t *shm_log_open(const char *path)
+{
+    shm_log_t *log = log_malloc(path);
+    if (log == NULL)
+        return NULL;
+
+    log->info = shared_file_open(path);
+    if (log->info == NULL)
+        goto err;
+    if (log->info->size < sizeof(shm_log_header_t))
+        goto err;
+
+    shm_log_header_t *header = log->info->ptr;
+    if (header->flag != LOG_FLAG)
+        goto err;
+    log_boot_check(header);
+    log->header = header;
+    return log;
+
+err:
+    shm_log_close(log);
+    return NULL;
+}
+
+void shm_log_close(shm_log_t *log)
+{
+    for (uint32_t i = 0; i < log->nsegs; i++) {
+        if (log->segs[i] != NULL)
+            shared_memory_close(log->segs[i]);
+    }
+    free(log->segs);
+    if (log->info != NULL)
+        shared_memory_close(log->info);
+    pthread_mutex_destroy(&log->mutex);
+    free(log->path);
+    free(log);
+}
+
+int shm_log_remove(const char *path)
+{
+    char seg_path[4096];
+    shm_log_t *log = shm_log_open(path);
+    if (log != NULL) {
+        uint64_t segsize = log->header->segsize;
+        uint32_t first = log->header->head / segsize;
+        uint32_t last = log->header->tail / segsize;
+        for (uint32_t i = first; i <= last; i++) {
+            if (log_segment_path(log, i, seg_path, sizeof(seg_path)) == 0)
+                unlink(seg_path);
+        }
+        shm_log_close(log);
+    }
+    return unlink(path);
+}
+
+int64_t shm_log_append(shm_log_t *log, const void *data, uint32_t len)
+{
+    shm_log_header_t *header = log->header;
+    uint64_t segsize = header->segsize;
+    uint64_t total = log_record_size(len);
+    if (total > segsize)
+        return -1;
+
+    log_lock(log);
+
+    uint64_t tail = header->tail;
+    uint64_t pos = tail % segsize;
+    uint8_t *seg;
+    if (pos + total > segsize) {
+        // seal current segment, record never span two segments
+        seg = log_segment(log, tail / segsize, 1);
+        if (seg == NULL)
+            goto err;
+        if (pos + sizeof(shm_log_record_t) <= segsize) {
+            shm_log_record_t *pad = (shm_log_record_t *)(seg + pos);
+            pad->len = 0;
+            pad->flag = LOG_RECORD_PAD;
+        }
+        if (header->sync != SHM_LOG_SYNC_NONE)
+            msync(seg, segsize, MS_SYNC);
+        tail += segsize - pos;
+        pos = 0;
+    }
+
+    seg = log_segment(log, tail / segsize, 1);
+    if (seg == NULL)
+        goto err;
+
+    shm_log_record_t *rec = (shm_log_record_t *)(seg + pos);
+    rec->len = len;
+    rec->flag = LOG_RECORD_DATA;
+    memcpy(rec->data, data, len);
+    if (header->sync == SHM_LOG_SYNC_RECORD && log_msync(rec, total, MS_SYNC) != 0)
+        goto err;
+
+    // publish record to readers
+    __atomic_store_n(&header->tail, tail + total, __ATOMIC_RELEASE);
+    if (header->sync == SHM_LOG_SYNC_RECORD)
+        log_msync(&header->tail, sizeof(header->tail), MS_SYNC);
+
+    log_unlock(log);
+    return tail;
+
+err:
+    log_unlock(log);
+    return -1;
+}
+
+int shm_log_read(shm_log_t *log, uint64_t *offset, const void **data, uint32_t *len)
+{
+    shm_log_header_t *header = log->header;
+    uint64_t segsize = header->segsize;
+    uint64_t off = *offset;
+    if (off % 8 != 0 || off < __atomic_load_n(&header->head, __ATOMIC_ACQUIRE))
+        return -1;
+
+    uint64_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+    while (off < tail) {
+        uint64_t pos = off % segsize;
+        if (pos + sizeof(shm_log_record_t) > segsize) {
+            off += segsize - pos;
+            continue;
+        }
+
+        uint8_t *seg = log_segment(log, off / segsize, 0);
+        if (seg == NULL)
+            return -1;
+        shm_log_record_t *rec = (shm_log_record_t *)(seg + pos);
+        if (rec->flag == LOG_RECORD_PAD) {
+            off += segsize - pos;
+            continue;
+        }
+        if (rec->flag != LOG_RECORD_DATA || pos + log_record_size(rec->len) > segsize)
+            return -1;
+
+        *data = rec->data;
+        *len = rec->len;
+        *offset = off + log_record_size(rec->len);
+        return 1;
+    }
+    *offset = off;
+    return 0;
+}
+
+int shm_log_sync(shm_log_t *log)
+{
+    int r = 0;
+    pthread_mutex_lock(&log->mutex);
+    for (uint32_t i = 0; i < log->nsegs; i++) {
+        if (log->segs[i] != NULL && msync(log->segs[i]->ptr, log->segs[i]->size, MS_SYNC) != 0)
+            r = -1;
+    }
+    pthread_mutex_unlock(&log->mutex);
+
+    if (msync(log->header, sizeof(shm_log_header_t), MS_SYNC) != 0)
+        r = -1;
+    return r;
+}
+
+int shm_log_trim(shm_log_t *log, uint64_t offset)
+{
+    char path[4096];
+    shm_log_header_t *header = log->header;
+    uint64_t segsize = header->segsize;
+
+    log_lock(log);
+    if (offset > header->tail)
+        offset = header->tail;
+    uint32_t first = header->head / segsize;
+    uint32_t last = offset / segsize;
+    if (last <= first) {
+        log_unlock(log);
+        return 0;
+    }
+    __atomic_store_n(&header->head, (uint64_t)last * segsize, __ATOMIC_RELEASE);
+    if (header->sync != SHM_LOG_SYNC_NONE)
+        msync(header, sizeof(shm_log_header_t), MS_SYNC);
+
+    int r = 0;
+    pthread_mutex_lock(&log->mutex);
+    for (uint32_t i = first; i < last; i++) {
+        if (i < log->nsegs && log->segs[i] != NULL) {
+            shared_memory_close(log->segs[i]);
+            log->segs[i] = NULL;
+        }
+        if (log_segment_path(log, i, path, sizeof(path)) != 0 || unlink(path) != 0)
+            r = -1;
+    }
+    pthread_mutex_unlock(&log->mutex);
+
+    log_unlock(log);
+    return r;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "shm_trace.h"
+
+// USDT probes of provider shmutil, nop unless attached, e.g.
+//   bpftrace -e 'usdt:./app:shmutil:queue_full { @[arg1] = count(); }'
+#ifdef SHMUTIL_HAVE_SDT
+#include <sys/sdt.h>
+#define SHM_PROBE1(name, a) DTRACE_PROBE1(shmutil, name, a)
+#define SHM_PROBE2(name, a, b) DTRACE_PROBE2(shmutil, name, a, b)
+#else
+#define SHM_PROBE1(name, a) do {} while (0)
+#define SHM_PROBE2(name, a, b) do {} while (0)
+#endif
+
+#ifdef SHMUTIL_TRACE_HOOKS
+extern const shm_trace_hooks_t *shm_trace_hooks;
+#define SHM_HOOK(name, ...) do { \
+        const shm_trace_hooks_t *h_ = __atomic_load_n(&shm_trace_hooks, __ATOMIC_ACQUIRE); \
+        if (h_ != NULL && h_->name != NULL) \
+            h_->name(__VA_ARGS__); \
+    } while (0)
+#else
+#define SHM_HOOK(name, ...) do {} while (0)
+#endif
+
+#define SHM_TRACE1(name, a) do { SHM_PROBE1(name, a); SHM_HOOK(name, a); } while (0)
+#define SHM_TRACE2(name, a, b) do { SHM_PROBE2(name, a, b); SHM_HOOK(name, a, b); } while (0)
@@ -0,0 +1,520 @@
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#include "shm_rpc.h"
+#include "shm_lock.h"
+#include "shm_futex.h"
+
+// phase in low bits of slot state, call id in the others
+enum {
+    RPC_IDLE = 0,
+    RPC_PENDING = 1,    // request in ring, caller can cancel
+    RPC_SERVING = 2,    // server copied request
+    RPC_DONE = 3,       // response ready
+    RPC_ABANDONED = 4,  // caller timed out while serving, server set it back to idle
+};
+
+#define RPC_PHASE_BITS 3
+#define RPC_PHASE_MASK ((1u << RPC_PHASE_BITS) - 1)
+
+// round trip on two busy cores is well under the spin, a parked peer is not
+#define RPC_SPIN 1000
+
+// a peer stopped between its two steps on a ring cell longer than this is
+// taken as dead, the step is finished for it
+#define RPC_STALL_MS 100
+
+static uint32_t rpc_state(uint32_t id, uint32_t phase)
+{
+    return id << RPC_PHASE_BITS | phase;
+}
+
+static uint64_t rpc_align(uint64_t size)
+{
+    return (size + 63) & ~63ull;
+}
+
+static shm_rpc_slot_t *rpc_slot(shm_rpc_t *rpc, int32_t slot)
+{
+    return (shm_rpc_slot_t *)((uint8_t *)rpc + rpc->slotpos + rpc->slot_size * slot);
+}
+
+static uint32_t rpc_ring_size(int32_t nslots)
+{
+    // a slot is in the ring at most once, room for one more left by a dead caller
+    uint32_t size = 2;
+    while (size < (uint32_t)nslots * 2)
+        size *= 2;
+    return size;
+}
+
+static uint64_t rpc_cell_word(uint64_t pos, uint32_t slot)
+{
+    return (uint64_t)(uint32_t)pos << 32 | slot;
+}
+
+// distance of cell position from pos, positions wrap at 32 bits
+static int32_t rpc_cell_dif(uint64_t word, uint64_t pos)
+{
+    return (int32_t)((uint32_t)(word >> 32) - (uint32_t)pos);
+}
+
+typedef struct {
+    uint64_t pos;
+    int spins;
+    struct timespec start;
+} rpc_stall_t;
+
+// wait on a cell stuck at pos, 1 once it is stuck for RPC_STALL_MS
+static int rpc_stall(rpc_stall_t *st, uint64_t pos)
+{
+    if (st->spins == 0 || st->pos != pos) {
+        st->pos = pos;
+        st->spins = 1;
+        clock_gettime(CLOCK_MONOTONIC, &st->start);
+        return 0;
+    }
+    if (++st->spins % RPC_SPIN != 0) {
+        cpu_relax();
+        return 0;
+    }
+    sched_yield();
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ms = (now.tv_sec - st->start.tv_sec) * 1000 + (now.tv_nsec - st->start.tv_nsec) / 1000000;
+    return ms >= RPC_STALL_MS;
+}
+
+// bounded mpmc ring, position in cell tells whose turn it is, pusher and
+// popper move tail/head then the cell, a peer dead between the two steps
+// is finished by others, so a live but stalled pusher can lose its push
+static int rpc_ring_push(shm_rpc_t *rpc, uint32_t slot)
+{
+    rpc_stall_t st = {0};
+    uint64_t pos = __atomic_load_n(&rpc->tail, __ATOMIC_RELAXED);
+    shm_rpc_cell_t *cell;
+    uint64_t word;
+    while (1) {
+        cell = &rpc->ring[pos & rpc->ring_mask];
+        word = __atomic_load_n(&cell->word, __ATOMIC_ACQUIRE);
+        int32_t dif = rpc_cell_dif(word, pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&rpc->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            // not full if a popper took it and did not give the cell back
+            uint64_t prev = pos - rpc->ring_mask - 1;
+            if (rpc_cell_dif(word, prev + 1) != 0 || __atomic_load_n(&rpc->head, __ATOMIC_RELAXED) <= prev)
+                return -1;
+            if (rpc_stall(&st, pos))
+                __atomic_compare_exchange_n(&cell->word, &word, rpc_cell_word(pos, 0), 0, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&rpc->tail, __ATOMIC_RELAXED);
+        }
+    }
+    // fail if a popper gave up waiting and skipped the cell
+    return __atomic_compare_exchange_n(&cell->word, &word, rpc_cell_word(pos + 1, slot), 0, __ATOMIC_RELEASE,
+                                       __ATOMIC_RELAXED) ? 0 : -1;
+}
+
+static int rpc_ring_pop(shm_rpc_t *rpc, uint32_t *slot)
+{
+    rpc_stall_t st = {0};
+    uint64_t pos = __atomic_load_n(&rpc->head, __ATOMIC_RELAXED);
+    shm_rpc_cell_t *cell;
+    uint64_t word;
+    while (1) {
+        cell = &rpc->ring[pos & rpc->ring_mask];
+        word = __atomic_load_n(&cell->word, __ATOMIC_ACQUIRE);
+        int32_t dif = rpc_cell_dif(word, pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&rpc->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            // empty, or a pusher took the cell and did not fill it
+            if (dif != -1 || __atomic_load_n(&rpc->tail, __ATOMIC_RELAXED) <= pos)
+                return -1;
+            if (rpc_stall(&st, pos) &&
+                __atomic_compare_exchange_n(&rpc->head, &pos, pos + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                uint64_t next = rpc_cell_word(pos + rpc->ring_mask + 1, 0);
+                if (__atomic_compare_exchange_n(&cell->word, &word, next, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+                    pos++;
+                    continue;
+                }
+                // filled just now, take it
+                break;
+            }
+        } else {
+            pos = __atomic_load_n(&rpc->head, __ATOMIC_RELAXED);
+        }
+    }
+    *slot = (uint32_t)word;
+    // a pusher may have given the cell back for us if we stalled here
+    __atomic_compare_exchange_n(&cell->word, &word, rpc_cell_word(pos + rpc->ring_mask + 1, 0), 0,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int rpc_push_slot(shm_rpc_t *rpc, int32_t slot);
+
+// 1 if an entry of slot is in ring
+static int rpc_ring_has(shm_rpc_t *rpc, uint32_t slot)
+{
+    uint64_t head = __atomic_load_n(&rpc->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(&rpc->tail, __ATOMIC_ACQUIRE);
+    for (uint64_t pos = head; pos != tail && pos - head <= rpc->ring_mask; pos++) {
+        uint64_t word = __atomic_load_n(&rpc->ring[pos & rpc->ring_mask].word, __ATOMIC_ACQUIRE);
+        if (rpc_cell_dif(word, pos + 1) == 0 && (uint32_t)word == slot)
+            return 1;
+    }
+    return 0;
+}
+
+// server that took call id is alive, 0 if none took it
+static int rpc_server_alive(uint64_t server, uint32_t id)
+{
+    if ((uint32_t)(server >> 32) != id || (uint32_t)server == 0)
+        return 0;
+    return !shm_lock_owner_dead((uint32_t)server);
+}
+
+// a parked caller wakes every RPC_STALL_MS to look after its server
+static const struct timespec *rpc_check_deadline(const struct timespec *deadline, struct timespec *check)
+{
+    futex_deadline(RPC_STALL_MS, check);
+    if (deadline != NULL && (deadline->tv_sec < check->tv_sec ||
+                             (deadline->tv_sec == check->tv_sec && deadline->tv_nsec <= check->tv_nsec)))
+        return deadline;
+    return check;
+}
+
+// server died serving call id, or with the entry of it still pending,
+// EOWNERDEAD if the call is lost
+static int rpc_check_server(shm_rpc_t *rpc, int32_t slot, uint32_t id)
+{
+    shm_rpc_slot_t *s = rpc_slot(rpc, slot);
+    if (rpc_server_alive(__atomic_load_n(&s->server, __ATOMIC_ACQUIRE), id))
+        return 0;
+
+    uint32_t state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+    if (state == rpc_state(id, RPC_SERVING)) {
+        // serving always has a server recorded, and it is dead
+        if (__atomic_compare_exchange_n(&s->state, &state, rpc_state(id, RPC_IDLE), 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED))
+            return EOWNERDEAD;
+    } else if (state == rpc_state(id, RPC_PENDING) && !rpc_ring_has(rpc, slot)) {
+        __atomic_store_n(&s->queued, 0, __ATOMIC_SEQ_CST);
+        rpc_push_slot(rpc, slot);
+    }
+    return 0;
+}
+
+// same as shm_sync, the caller counts itself in waiters before it checks
+// state and the server changes state before it reads waiters
+static void rpc_wake(shm_rpc_slot_t *s, uint32_t state)
+{
+    __atomic_store_n(&s->state, state, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&s->state, INT32_MAX);
+}
+
+// wait while a call abandoned before is served, 0 when it leaves, ETIMEDOUT
+// after deadline, a dead server leaves it to us
+static int rpc_wait_abandoned(shm_rpc_slot_t *s, const struct timespec *deadline)
+{
+    for (int i = 0; i < RPC_SPIN; i++) {
+        if ((__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) & RPC_PHASE_MASK) != RPC_ABANDONED)
+            return 0;
+        cpu_relax();
+    }
+
+    int r = 0;
+    __atomic_add_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    while (1) {
+        uint32_t state = __atomic_load_n(&s->state, __ATOMIC_SEQ_CST);
+        if ((state & RPC_PHASE_MASK) != RPC_ABANDONED)
+            break;
+        struct timespec check;
+        const struct timespec *until = rpc_check_deadline(deadline, &check);
+        if (futex_wait_until(&s->state, state, until) != ETIMEDOUT)
+            continue;
+        uint32_t id = state >> RPC_PHASE_BITS;
+        if (until != deadline) {
+            if (!rpc_server_alive(__atomic_load_n(&s->server, __ATOMIC_ACQUIRE), id))
+                __atomic_compare_exchange_n(&s->state, &state, rpc_state(id, RPC_IDLE), 0, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_RELAXED);
+            continue;
+        }
+        r = ETIMEDOUT;
+        break;
+    }
+    __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    return r;
+}
+
+// wait until call id is done, cancel it on timeout
+static int rpc_wait_done(shm_rpc_t *rpc, int32_t slot, uint32_t id, const struct timespec *deadline)
+{
+    shm_rpc_slot_t *s = rpc_slot(rpc, slot);
+    for (int i = 0; i < RPC_SPIN; i++) {
+        if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) == rpc_state(id, RPC_DONE))
+            return 0;
+        cpu_relax();
+    }
+
+    int r = 0;
+    __atomic_add_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    while (1) {
+        uint32_t state = __atomic_load_n(&s->state, __ATOMIC_SEQ_CST);
+        if (state == rpc_state(id, RPC_DONE))
+            break;
+        struct timespec check;
+        const struct timespec *until = rpc_check_deadline(deadline, &check);
+        if (futex_wait_until(&s->state, state, until) != ETIMEDOUT)
+            continue;
+        if (until != deadline) {
+            if ((r = rpc_check_server(rpc, slot, id)) != 0)
+                break;
+            continue;
+        }
+
+        // not taken yet is canceled at once, being served is left to the server
+        state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+        while (state != rpc_state(id, RPC_DONE)) {
+            uint32_t next = rpc_state(id, state == rpc_state(id, RPC_PENDING) ? RPC_IDLE : RPC_ABANDONED);
+            if (__atomic_compare_exchange_n(&s->state, &state, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                r = ETIMEDOUT;
+                break;
+            }
+        }
+        break;
+    }
+    __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    return r;
+}
+
+size_t shm_rpc_size(int32_t nslots, int32_t msgsize)
+{
+    if (nslots <= 0 || msgsize <= 0)
+        return 0;
+    return rpc_align(sizeof(shm_rpc_t) + sizeof(shm_rpc_cell_t) * rpc_ring_size(nslots)) +
+           rpc_align(sizeof(shm_rpc_slot_t) + msgsize) * nslots;
+}
+
+shm_rpc_t *shm_rpc_create(void *ptr, int32_t nslots, int32_t msgsize)
+{
+    if (nslots <= 0 || msgsize <= 0)
+        return NULL;
+
+    shm_rpc_t *rpc = ptr;
+    rpc->nslots = nslots;
+    rpc->msgsize = msgsize;
+    rpc->ring_mask = rpc_ring_size(nslots) - 1;
+    rpc->slotpos = rpc_align(sizeof(shm_rpc_t) + sizeof(shm_rpc_cell_t) * (rpc->ring_mask + 1));
+    rpc->slot_size = rpc_align(sizeof(shm_rpc_slot_t) + msgsize);
+    shm_sem_create(&rpc->pending, 0);
+    rpc->head = 0;
+    rpc->tail = 0;
+    for (uint32_t i = 0; i <= rpc->ring_mask; i++)
+        rpc->ring[i].word = rpc_cell_word(i, 0);
+    for (int32_t i = 0; i < nslots; i++) {
+        shm_rpc_slot_t *s = rpc_slot(rpc, i);
+        s->state = rpc_state(0, RPC_IDLE);
+        s->waiters = 0;
+        s->owner = 0;
+        s->queued = 0;
+        s->len = 0;
+        s->server = 0;
+    }
+    __atomic_store_n(&rpc->flag, 0xa1a28182, __ATOMIC_RELEASE);
+    return rpc;
+}
+
+shm_rpc_t *shm_rpc_open(void *ptr)
+{
+    shm_rpc_t *rpc = ptr;
+    if (__atomic_load_n(&rpc->flag, __ATOMIC_ACQUIRE) != 0xa1a28182)
+        return NULL;
+    return rpc;
+}
+
+// push slot unless an entry of it is still in ring, a canceled call leaves
+// its entry and the next call is served by it, so the ring never holds
+// more than one live entry per slot
+static int rpc_push_slot(shm_rpc_t *rpc, int32_t slot)
+{
+    shm_rpc_slot_t *s = rpc_slot(rpc, slot);
+    uint32_t self = shm_lock_self();
+    // seq_cst against the server, it clears queued then reads state
+    uint32_t queued = __atomic_load_n(&s->queued, __ATOMIC_SEQ_CST);
+    while (1) {
+        if (queued != 0 && (queued == self || !shm_lock_owner_dead(queued)))
+            return 0;
+        if (__atomic_compare_exchange_n(&s->queued, &queued, self, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            break;
+    }
+    if (rpc_ring_push(rpc, slot) != 0) {
+        __atomic_store_n(&s->queued, 0, __ATOMIC_RELAXED);
+        return -1;
+    }
+    shm_sem_post(&rpc->pending, 1);
+    return 0;
+}
+
+int32_t shm_rpc_attach(shm_rpc_t *rpc)
+{
+    uint32_t self = shm_lock_self();
+    for (int32_t i = 0; i < rpc->nslots; i++) {
+        shm_rpc_slot_t *s = rpc_slot(rpc, i);
+        uint32_t owner = __atomic_load_n(&s->owner, __ATOMIC_RELAXED);
+        if (owner != 0 && !shm_lock_owner_dead(owner))
+            continue;
+        if (__atomic_compare_exchange_n(&s->owner, &owner, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return i;
+    }
+    return -1;
+}
+
+void shm_rpc_detach(shm_rpc_t *rpc, int32_t slot)
+{
+    if (slot < 0 || slot >= rpc->nslots)
+        return;
+    __atomic_store_n(&rpc_slot(rpc, slot)->owner, 0, __ATOMIC_RELEASE);
+}
+
+int shm_rpc_call(shm_rpc_t *rpc, int32_t slot, const void *request, int len,
+                 void *response, int *response_len, int timeout_ms)
+{
+    if (slot < 0 || slot >= rpc->nslots)
+        return EINVAL;
+    if (len < 0 || len > rpc->msgsize)
+        return EMSGSIZE;
+
+    struct timespec deadline;
+    if (timeout_ms >= 0)
+        futex_deadline(timeout_ms, &deadline);
+    shm_rpc_slot_t *s = rpc_slot(rpc, slot);
+
+    // a call abandoned before may still be served, its response goes to data
+    if (rpc_wait_abandoned(s, timeout_ms >= 0 ? &deadline : NULL) == ETIMEDOUT)
+        return ETIMEDOUT;
+
+    uint32_t id = (__atomic_load_n(&s->state, __ATOMIC_RELAXED) >> RPC_PHASE_BITS) + 1;
+    memcpy(s->data, request, len);
+    s->len = len;
+    __atomic_store_n(&s->state, rpc_state(id, RPC_PENDING), __ATOMIC_SEQ_CST);
+    if (rpc_push_slot(rpc, slot) != 0) {
+        // a server may have taken it through an old entry
+        uint32_t pending = rpc_state(id, RPC_PENDING);
+        if (__atomic_compare_exchange_n(&s->state, &pending, rpc_state(id, RPC_IDLE), 0, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+            return EAGAIN;
+    }
+
+    int r = rpc_wait_done(rpc, slot, id, timeout_ms >= 0 ? &deadline : NULL);
+    if (r != 0)
+        return r;
+
+    int n = s->len;
+    if (n > *response_len) {
+        n = *response_len;
+        r = EMSGSIZE;
+    }
+    memcpy(response, s->data, n);
+    *response_len = s->len;
+    __atomic_store_n(&s->state, rpc_state(id, RPC_IDLE), __ATOMIC_RELAXED);
+    return r;
+}
+
+int shm_rpc_recv(shm_rpc_t *rpc, shm_rpc_request_t *request, void *buffer, int *len, int timeout_ms)
+{
+    if (*len < rpc->msgsize)
+        return EINVAL;
+
+    struct timespec deadline;
+    if (timeout_ms >= 0)
+        futex_deadline(timeout_ms, &deadline);
+
+    while (1) {
+        int r = EAGAIN;
+        for (int i = 0; i < RPC_SPIN && r != 0; i++) {
+            r = shm_sem_trywait(&rpc->pending);
+            if (r != 0)
+                cpu_relax();
+        }
+        if (r != 0) {
+            int wait_ms = SHM_WAIT_INFINITE;
+            if (timeout_ms >= 0) {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                int64_t ns = (deadline.tv_sec - now.tv_sec) * 1000000000ll + deadline.tv_nsec - now.tv_nsec;
+                wait_ms = ns > 0 ? (ns + 999999) / 1000000 : 0;
+            }
+            if (shm_sem_wait(&rpc->pending, wait_ms) == ETIMEDOUT)
+                return ETIMEDOUT;
+        }
+
+        // an entry without a token is left by a dead caller, so pop until a
+        // call is taken or the ring is empty, not one entry per token
+        uint32_t slot;
+        while (rpc_ring_pop(rpc, &slot) == 0) {
+            if (slot >= (uint32_t)rpc->nslots)
+                continue;
+            shm_rpc_slot_t *s = rpc_slot(rpc, slot);
+            __atomic_store_n(&s->queued, 0, __ATOMIC_SEQ_CST);
+            // the entry serves whatever call of the slot is pending now
+            uint32_t state = __atomic_load_n(&s->state, __ATOMIC_SEQ_CST);
+            if ((state & RPC_PHASE_MASK) != RPC_PENDING)
+                continue;
+            uint32_t id = state >> RPC_PHASE_BITS;
+            // record ourself before serving, so the caller can tell if we die,
+            // a live server that recorded the same call serves it
+            uint64_t server = __atomic_load_n(&s->server, __ATOMIC_ACQUIRE);
+            if (rpc_server_alive(server, id))
+                continue;
+            if (!__atomic_compare_exchange_n(&s->server, &server, (uint64_t)id << 32 | shm_lock_self(), 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                continue;
+            if (!__atomic_compare_exchange_n(&s->state, &state, rpc_state(id, RPC_SERVING), 0, __ATOMIC_ACQUIRE,
+                                             __ATOMIC_RELAXED))
+                continue;
+
+            *len = s->len;
+            memcpy(buffer, s->data, s->len);
+            request->slot = slot;
+            request->id = id;
+            return 0;
+        }
+    }
+}
+
+int shm_rpc_reply(shm_rpc_t *rpc, const shm_rpc_request_t *request, const void *data, int len)
+{
+    if (request->slot < 0 || request->slot >= rpc->nslots)
+        return EINVAL;
+    if (len < 0 || len > rpc->msgsize)
+        return EMSGSIZE;
+
+    shm_rpc_slot_t *s = rpc_slot(rpc, request->slot);
+    uint32_t serving = rpc_state(request->id, RPC_SERVING);
+    uint32_t state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+    if (state == serving) {
+        memcpy(s->data, data, len);
+        s->len = len;
+        // seq_cst as rpc_wake, caller may park right now
+        if (__atomic_compare_exchange_n(&s->state, &state, rpc_state(request->id, RPC_DONE), 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST) > 0)
+                futex_wake(&s->state, INT32_MAX);
+            return 0;
+        }
+    }
+    if (state == rpc_state(request->id, RPC_ABANDONED)) {
+        rpc_wake(s, rpc_state(request->id, RPC_IDLE));
+        return ECANCELED;
+    }
+    return EINVAL;
+}
@@ -0,0 +1,236 @@
+#include <errno.h>
+#include <time.h>
+
+#include "shm_sync.h"
+#include "shm_futex.h"
+
+// waiters is increased before the futex word is checked, and posters
+// change the word before they read waiters, both seq_cst, so a poster
+// either see the waiter or the waiter see the new word
+
+void shm_event_create(shm_event_t *event, int manual, int set)
+{
+    event->waiters = 0;
+    event->manual = manual != 0;
+    event->reserve = 0;
+    __atomic_store_n(&event->state, set != 0, __ATOMIC_RELEASE);
+}
+
+void shm_event_set(shm_event_t *event)
+{
+    if (__atomic_exchange_n(&event->state, 1, __ATOMIC_SEQ_CST) == 1)
+        return;
+    if (__atomic_load_n(&event->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&event->state, event->manual ? INT32_MAX : 1);
+}
+
+void shm_event_reset(shm_event_t *event)
+{
+    __atomic_store_n(&event->state, 0, __ATOMIC_RELEASE);
+}
+
+static int event_tryacquire(shm_event_t *event)
+{
+    if (event->manual)
+        return __atomic_load_n(&event->state, __ATOMIC_ACQUIRE) == 1;
+    uint32_t c = 1;
+    return __atomic_compare_exchange_n(&event->state, &c, 0, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+int shm_event_wait(shm_event_t *event, int timeout_ms)
+{
+    if (event_tryacquire(event))
+        return 0;
+
+    struct timespec deadline;
+    if (timeout_ms >= 0)
+        futex_deadline(timeout_ms, &deadline);
+
+    int r = 0;
+    __atomic_add_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+    while (!event_tryacquire(event)) {
+        if (futex_wait_until(&event->state, 0, timeout_ms >= 0 ? &deadline : NULL) == ETIMEDOUT) {
+            r = ETIMEDOUT;
+            break;
+        }
+    }
+    __atomic_sub_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+    return r;
+}
+
+void shm_sem_create(shm_sem_t *sem, uint32_t value)
+{
+    sem->waiters = 0;
+    __atomic_store_n(&sem->value, value, __ATOMIC_RELEASE);
+}
+
+void shm_sem_post(shm_sem_t *sem, uint32_t n)
+{
+    __atomic_add_fetch(&sem->value, n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&sem->value, n > INT32_MAX ? INT32_MAX : (int)n);
+}
+
+int shm_sem_trywait(shm_sem_t *sem)
+{
+    uint32_t v = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+    while (v > 0) {
+        if (__atomic_compare_exchange_n(&sem->value, &v, v - 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 0;
+    }
+    return EAGAIN;
+}
+
+int shm_sem_wait(shm_sem_t *sem, int timeout_ms)
+{
+    if (shm_sem_trywait(sem) == 0)
+        return 0;
+
+    struct timespec deadline;
+    if (timeout_ms >= 0)
+        futex_deadline(timeout_ms, &deadline);
+
+    int r = 0;
+    __atomic_add_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+    while (shm_sem_trywait(sem) != 0) {
+        if (futex_wait_until(&sem->value, 0, timeout_ms >= 0 ? &deadline : NULL) == ETIMEDOUT) {
+            r = ETIMEDOUT;
+            break;
+        }
+    }
+    __atomic_sub_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+    return r;
+}
+
+void shm_cond_create(shm_cond_t *cond)
+{
+    cond->waiters = 0;
+    __atomic_store_n(&cond->seq, 0, __ATOMIC_RELEASE);
+}
+
+int shm_cond_wait(shm_cond_t *cond, shm_lock_t *lock, int timeout_ms)
+{
+    struct timespec deadline;
+    if (timeout_ms >= 0)
+        futex_deadline(timeout_ms, &deadline);
+
+    __atomic_add_fetch(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+    uint32_t seq = __atomic_load_n(&cond->seq, __ATOMIC_SEQ_CST);
+    shm_lock_release(lock);
+
+    int r = futex_wait_until(&cond->seq, seq, timeout_ms >= 0 ? &deadline : NULL);
+
+    __atomic_sub_fetch(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+    if (shm_lock_acquire(lock) == EOWNERDEAD)
+        return EOWNERDEAD;
+    return r;
+}
+
+void shm_cond_signal(shm_cond_t *cond)
+{
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&cond->seq, 1);
+}
+
+void shm_cond_broadcast(shm_cond_t *cond)
+{
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&cond->seq, INT32_MAX);
+}
+
+int shm_once_begin(shm_once_t *once)
+{
+    uint32_t c = __atomic_load_n(&once->state, __ATOMIC_ACQUIRE);
+    while (c == SHM_ONCE_INIT || c == SHM_ONCE_FAILED) {
+        if (__atomic_compare_exchange_n(&once->state, &c, SHM_ONCE_INITIALIZING, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            return 1;
+    }
+    return 0;
+}
+
+void shm_once_reset(shm_once_t *once)
+{
+    __atomic_store_n(&once->state, SHM_ONCE_INITIALIZING, __ATOMIC_SEQ_CST);
+}
+
+void shm_once_end(shm_once_t *once, int ok)
+{
+    __atomic_store_n(&once->state, ok ? SHM_ONCE_READY : SHM_ONCE_FAILED, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&once->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&once->state, INT32_MAX);
+}
+
+int shm_once_wait(shm_once_t *once, int timeout_ms)
+{
+    uint32_t c = __atomic_load_n(&once->state, __ATOMIC_ACQUIRE);
+    if (c == SHM_ONCE_READY)
+        return 0;
+
+    struct timespec deadline;
+    if (timeout_ms >= 0)
+        futex_deadline(timeout_ms, &deadline);
+
+    int r = 0;
+    __atomic_add_fetch(&once->waiters, 1, __ATOMIC_SEQ_CST);
+    while ((c = __atomic_load_n(&once->state, __ATOMIC_SEQ_CST)) != SHM_ONCE_READY) {
+        if (c == SHM_ONCE_FAILED) {
+            r = ECANCELED;
+            break;
+        }
+        if (futex_wait_until(&once->state, c, timeout_ms >= 0 ? &deadline : NULL) == ETIMEDOUT) {
+            r = ETIMEDOUT;
+            break;
+        }
+    }
+    __atomic_sub_fetch(&once->waiters, 1, __ATOMIC_SEQ_CST);
+    return r;
+}
+
+#define BARRIER_ARRIVED(w) ((w) & 0xffff)
+#define BARRIER_GENERATION(w) ((w) >> 16)
+
+int shm_barrier_create(shm_barrier_t *barrier, uint32_t count)
+{
+    if (count == 0 || count > 0xffff)
+        return -1;
+    barrier->count = count;
+    __atomic_store_n(&barrier->word, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int shm_barrier_wait(shm_barrier_t *barrier, int timeout_ms)
+{
+    uint32_t w = __atomic_load_n(&barrier->word, __ATOMIC_RELAXED);
+    uint32_t next;
+    while (1) {
+        if (BARRIER_ARRIVED(w) + 1 == barrier->count)
+            next = (BARRIER_GENERATION(w) + 1) << 16;
+        else
+            next = w + 1;
+        if (__atomic_compare_exchange_n(&barrier->word, &w, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    if (BARRIER_ARRIVED(next) == 0) {
+        futex_wake(&barrier->word, INT32_MAX);
+        return SHM_BARRIER_SERIAL;
+    }
+
+    struct timespec deadline;
+    if (timeout_ms >= 0)
+        futex_deadline(timeout_ms, &deadline);
+
+    uint32_t generation = BARRIER_GENERATION(next);
+    while (BARRIER_GENERATION(w = __atomic_load_n(&barrier->word, __ATOMIC_ACQUIRE)) == generation) {
+        if (futex_wait_until(&barrier->word, w, timeout_ms >= 0 ? &deadline : NULL) != ETIMEDOUT)
+            continue;
+        // leave the barrier if it is not released yet
+        while (BARRIER_GENERATION(w) == generation) {
+            if (__atomic_compare_exchange_n(&barrier->word, &w, w - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                return ETIMEDOUT;
+        }
+    }
+    return 0;
+}
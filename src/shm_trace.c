@@ -0,0 +1,17 @@
+#include <stddef.h>
+
+#include "shm_probe.h"
+
+#ifdef SHMUTIL_TRACE_HOOKS
+const shm_trace_hooks_t *shm_trace_hooks = NULL;
+#endif
+
+int shm_trace_set_hooks(const shm_trace_hooks_t *hooks)
+{
+#ifdef SHMUTIL_TRACE_HOOKS
+    __atomic_store_n(&shm_trace_hooks, hooks, __ATOMIC_RELEASE);
+    return 0;
+#else
+    return -1;
+#endif
+}
@@ -1,12 +1,31 @@
+#define _GNU_SOURCE
+#include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
 #include <unistd.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <fcntl.h>
 
 #include "shmutil.h"
 
+#ifndef SHM_HUGETLBFS_PATH
+#define SHM_HUGETLBFS_PATH "/dev/hugepages"
+#endif
+
+#define SEGMENT_FLAG 0xa1a25150
+
+#ifndef HUGETLBFS_MAGIC
+#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+
 static shm_info_t *shm_info_malloc()
 {
     shm_info_t *info = malloc(sizeof(shm_info_t));
@@ -15,27 +34,102 @@ static shm_info_t *shm_info_malloc()
     info->fd = -1;
     info->size = 0;
     info->ptr = NULL;
+    info->flags = 0;
+    info->pagesize = sysconf(_SC_PAGESIZE);
+    info->generation = 0;
     return info;
 }
 
-shm_info_t *shared_memory_create(const char *name, size_t size)
+// file on hugetlbfs must be sized and mapped by its huge page size
+static int shm_info_pagesize(shm_info_t *info)
+{
+    struct statfs sfs;
+    if (fstatfs(info->fd, &sfs) < 0)
+        return -1;
+    if (sfs.f_type == HUGETLBFS_MAGIC) {
+        info->flags |= SHM_FLAG_HUGETLB;
+        info->pagesize = sfs.f_bsize;
+    }
+    return 0;
+}
+
+static int shm_info_map(shm_info_t *info, size_t size, uint32_t flags)
+{
+    // populate after numa policy is set, or pages land on local node
+    int mflags = MAP_SHARED;
+    if ((flags & SHM_FLAG_POPULATE) && !(flags & SHM_FLAG_NUMA_INTERLEAVE))
+        mflags |= MAP_POPULATE;
+
+    int prot = PROT_READ | PROT_WRITE;
+    if (flags & SHM_FLAG_RDONLY) {
+        prot = PROT_READ;
+        info->flags |= SHM_FLAG_RDONLY;
+    }
+
+    info->size = size;
+    info->ptr = mmap(NULL, size, prot, mflags, info->fd, 0);
+    if (MAP_FAILED == info->ptr) {
+        info->ptr = NULL;
+        return -1;
+    }
+
+    if (mflags & MAP_POPULATE)
+        info->flags |= SHM_FLAG_POPULATE;
+    if ((flags & SHM_FLAG_NUMA_INTERLEAVE) &&
+        shared_memory_numa_bind(info->ptr, size, SHM_NUMA_INTERLEAVE, SHM_NUMA_ALL_NODES) == 0)
+        info->flags |= SHM_FLAG_NUMA_INTERLEAVE;
+    // populate was deferred for the policy, do it even if mbind failed
+    if (!(mflags & MAP_POPULATE) && (flags & SHM_FLAG_POPULATE) && shared_memory_prefault(info, 0) == 0)
+        info->flags |= SHM_FLAG_POPULATE;
+
+    // transparent huge page is only an advice, ignore failure
+    if ((flags & SHM_FLAG_THP) && !(info->flags & SHM_FLAG_HUGETLB)) {
+        if (madvise(info->ptr, size, MADV_HUGEPAGE) == 0)
+            info->flags |= SHM_FLAG_THP;
+    }
+
+    // prefault and lock are best effort too, caller check info->flags
+    if ((flags & SHM_FLAG_PREFAULT) && shared_memory_prefault(info, 0) == 0)
+        info->flags |= SHM_FLAG_PREFAULT;
+    if ((flags & SHM_FLAG_LOCK) && mlock(info->ptr, size) == 0)
+        info->flags |= SHM_FLAG_LOCK;
+    return 0;
+}
+
+static shm_info_t *shm_info_create(int fd, size_t size, uint32_t flags)
 {
     shm_info_t *info = shm_info_malloc();
-    if (info == NULL)
+    if (info == NULL) {
+        if (fd >= 0)
+            close(fd);
         return NULL;
+    }
 
-    info->fd = shm_open(name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    // creator always write the segment
+    flags &= ~SHM_FLAG_RDONLY;
+    info->fd = fd;
     if (info->fd < 0)
         goto err;
+    if (shm_info_pagesize(info) != 0)
+        goto err;
+    if (info->flags & SHM_FLAG_HUGETLB)
+        size = (size + info->pagesize - 1) / info->pagesize * info->pagesize;
+    if ((flags & SHM_FLAG_GROWABLE) && size < sizeof(shm_segment_t))
+        goto err;
     if (ftruncate(info->fd, size) < 0)
         goto err;
-    info->size = size;
-    info->ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, info->fd, 0);
-    if (MAP_FAILED == info->ptr) {
-        info->ptr = NULL;
+    if (shm_info_map(info, size, flags) != 0)
         goto err;
-    }
 
+    if (flags & SHM_FLAG_GROWABLE) {
+        shm_segment_t *seg = info->ptr;
+        seg->size = size;
+        seg->generation = 1;
+        shm_lock_create(&seg->lock, SHM_LOCK_DEFAULT_SPIN);
+        seg->flag = SEGMENT_FLAG;
+        info->flags |= SHM_FLAG_GROWABLE;
+        info->generation = 1;
+    }
     return info;
 
 err:
@@ -43,25 +137,54 @@ err:
     return NULL;
 }
 
-shm_info_t *shared_memory_open(const char *name)
+static int shm_info_remap(shm_info_t *info, size_t size)
+{
+    void *ptr = mremap(info->ptr, info->size, size, MREMAP_MAYMOVE);
+    if (ptr == MAP_FAILED)
+        return -1;
+    info->ptr = ptr;
+    info->size = size;
+
+    if (info->flags & SHM_FLAG_THP)
+        madvise(info->ptr, size, MADV_HUGEPAGE);
+    if (info->flags & SHM_FLAG_LOCK)
+        mlock(info->ptr, size);
+    return 0;
+}
+
+static shm_info_t *shm_info_open(int fd, uint32_t flags)
 {
     struct stat st;
     shm_info_t *info = shm_info_malloc();
-    if (info == NULL)
+    if (info == NULL) {
+        if (fd >= 0)
+            close(fd);
         return NULL;
+    }
 
-    info->fd = shm_open(name, O_RDWR, S_IRUSR | S_IWUSR);
+    info->fd = fd;
     if (info->fd < 0)
         goto err;
+    if (shm_info_pagesize(info) != 0)
+        goto err;
     if (fstat(info->fd, &st) < 0)
         goto err;
-    info->size = st.st_size;
-    info->ptr = mmap(NULL, info->size, PROT_READ | PROT_WRITE, MAP_SHARED, info->fd, 0);
-    if (MAP_FAILED == info->ptr) {
-        info->ptr = NULL;
+    if (shm_info_map(info, st.st_size, flags) != 0)
         goto err;
-    }
 
+    shm_segment_t *seg = info->ptr;
+    if (info->size >= sizeof(shm_segment_t) && seg->flag == SEGMENT_FLAG) {
+        // a grow may run between fstat and here, file size is set before
+        // seg->size, so remap until the mapping cover it
+        info->flags |= SHM_FLAG_GROWABLE;
+        info->generation = __atomic_load_n(&seg->generation, __ATOMIC_ACQUIRE);
+        size_t size;
+        while ((size = __atomic_load_n(&seg->size, __ATOMIC_ACQUIRE)) > info->size) {
+            if (shm_info_remap(info, size) != 0)
+                goto err;
+            seg = info->ptr;
+        }
+    }
     return info;
 
 err:
@@ -69,6 +192,382 @@ err:
     return NULL;
 }
 
+static int hugetlbfs_path(const char *name, char *buffer, size_t size)
+{
+    while (*name == '/')
+        name++;
+    int r = snprintf(buffer, size, "%s/%s", SHM_HUGETLBFS_PATH, name);
+    if (r < 0 || (size_t)r >= size)
+        return -1;
+    return 0;
+}
+
+static shm_info_t *hugetlbfs_create(const char *name, size_t size, uint32_t flags)
+{
+    char path[PATH_MAX];
+    if (hugetlbfs_path(name, path, sizeof(path)) != 0)
+        return NULL;
+
+    int created = 1;
+    int fd = open(path, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0 && errno == EEXIST) {
+        created = 0;
+        fd = open(path, O_RDWR);
+    }
+    if (fd < 0)
+        return NULL;
+
+    shm_info_t *info = shm_info_create(fd, size, flags);
+    if (info != NULL && !(info->flags & SHM_FLAG_HUGETLB)) {
+        // path is not on hugetlbfs
+        shared_memory_close(info);
+        info = NULL;
+    }
+    if (info == NULL && created)
+        unlink(path);
+    return info;
+}
+
+shm_info_t *shared_memory_create(const char *name, size_t size)
+{
+    return shared_memory_create_ex(name, size, 0);
+}
+
+shm_info_t *shared_memory_create_ex(const char *name, size_t size, uint32_t flags)
+{
+    if (flags & SHM_FLAG_HUGETLB) {
+        shm_info_t *info = hugetlbfs_create(name, size, flags);
+        if (info != NULL)
+            return info;
+        // no huge page reserved, fall back to transparent huge page
+        flags |= SHM_FLAG_THP;
+    }
+    return shm_info_create(shm_open(name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR), size, flags);
+}
+
+shm_info_t *shared_memory_open(const char *name)
+{
+    return shared_memory_open_ex(name, 0);
+}
+
+shm_info_t *shared_memory_open_ex(const char *name, uint32_t flags)
+{
+    char path[PATH_MAX];
+    int oflag = (flags & SHM_FLAG_RDONLY) ? O_RDONLY : O_RDWR;
+    int fd = shm_open(name, oflag, S_IRUSR | S_IWUSR);
+    if (fd < 0 && errno == ENOENT && hugetlbfs_path(name, path, sizeof(path)) == 0)
+        fd = open(path, oflag);
+    return shm_info_open(fd, flags);
+}
+
+shm_info_t *shared_memory_create_anon(const char *name, size_t size, uint32_t flags)
+{
+    unsigned int mfd = MFD_CLOEXEC;
+    if (flags & SHM_FLAG_SEAL)
+        mfd |= MFD_ALLOW_SEALING;
+
+    int fd = -1;
+    if (flags & SHM_FLAG_HUGETLB)
+        fd = memfd_create(name, mfd | MFD_HUGETLB);
+    if (fd < 0) {
+        if (flags & SHM_FLAG_HUGETLB)
+            flags |= SHM_FLAG_THP;
+        fd = memfd_create(name, mfd);
+    }
+
+    shm_info_t *info = shm_info_create(fd, size, flags);
+    if (info == NULL)
+        return NULL;
+
+    // receivers can trust the size, no SIGBUS by others truncate
+    if (flags & SHM_FLAG_SEAL) {
+        if (fcntl(info->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+            shared_memory_close(info);
+            return NULL;
+        }
+        info->flags |= SHM_FLAG_SEAL;
+    }
+    return info;
+}
+
+shm_info_t *shared_memory_open_fd(int fd, uint32_t flags)
+{
+    shm_info_t *info = shm_info_open(fd, flags);
+    if (info == NULL)
+        return NULL;
+
+    int seals = fcntl(info->fd, F_GET_SEALS);
+    if (seals > 0 && (seals & F_SEAL_SHRINK))
+        info->flags |= SHM_FLAG_SEAL;
+    return info;
+}
+
+int shared_memory_send(int sock, const shm_info_t *info)
+{
+    uint64_t size = info->size;
+    struct iovec iov = {&size, sizeof(size)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctl, 0, sizeof(ctl));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &info->fd, sizeof(int));
+
+    ssize_t r;
+    do {
+        r = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (r < 0 && errno == EINTR);
+    return r == sizeof(size) ? 0 : -1;
+}
+
+shm_info_t *shared_memory_recv(int sock, uint32_t flags)
+{
+    uint64_t size = 0;
+    struct iovec iov = {&size, sizeof(size)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    ssize_t r;
+    do {
+        r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (r < 0 && errno == EINTR);
+
+    int fd = -1;
+    struct cmsghdr *cmsg = r > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    if (fd < 0)
+        return NULL;
+    if (r != sizeof(size) || (msg.msg_flags & MSG_CTRUNC)) {
+        close(fd);
+        return NULL;
+    }
+
+    shm_info_t *info = shared_memory_open_fd(fd, flags);
+    if (info != NULL && info->size != size) {
+        // sender truncate it after send
+        shared_memory_close(info);
+        return NULL;
+    }
+    return info;
+}
+
+shm_info_t *shared_file_create(const char *path, size_t size)
+{
+    return shm_info_create(open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR), size, 0);
+}
+
+shm_info_t *shared_file_open(const char *path)
+{
+    return shm_info_open(open(path, O_RDWR), 0);
+}
+
+int shared_memory_grow(shm_info_t *info, size_t size)
+{
+    if (!(info->flags & SHM_FLAG_GROWABLE))
+        return -1;
+    size = (size + info->pagesize - 1) / info->pagesize * info->pagesize;
+
+    // a dead grower left at most a longer file, size and generation are stored last
+    shm_segment_t *seg = info->ptr;
+    shm_lock_acquire(&seg->lock);
+    int r = -1;
+    if (shared_memory_remap(info) < 0)
+        goto out;
+    seg = info->ptr;
+    if (size <= seg->size) {
+        r = 0;
+        goto out;
+    }
+
+    if (ftruncate(info->fd, size) < 0)
+        goto out;
+    if (shm_info_remap(info, size) != 0)
+        goto out;
+
+    seg = info->ptr;
+    seg->size = size;
+    info->generation = __atomic_add_fetch(&seg->generation, 1, __ATOMIC_RELEASE);
+    r = 0;
+
+out:
+    shm_lock_release(&seg->lock);
+    return r;
+}
+
+int shared_memory_remap(shm_info_t *info)
+{
+    if (!(info->flags & SHM_FLAG_GROWABLE))
+        return -1;
+
+    shm_segment_t *seg = info->ptr;
+    uint32_t generation = __atomic_load_n(&seg->generation, __ATOMIC_ACQUIRE);
+    if (generation == info->generation)
+        return 0;
+
+    size_t size = seg->size;
+    if (size > info->size && shm_info_remap(info, size) != 0)
+        return -1;
+    info->generation = generation;
+    return 1;
+}
+
+int shared_memory_numa_nodes()
+{
+    static int nodes = 0;
+    int cached = __atomic_load_n(&nodes, __ATOMIC_RELAXED);
+    if (cached > 0)
+        return cached;
+
+    // online nodes, eg: "0-1" or "0,2-3", count up to the max node id
+    int n = 1;
+    FILE *fp = fopen("/sys/devices/system/node/online", "r");
+    if (fp != NULL) {
+        int a, b;
+        char sep;
+        while (fscanf(fp, "%d", &a) == 1) {
+            b = a;
+            if (fscanf(fp, "%c", &sep) == 1 && sep == '-' && fscanf(fp, "%d", &b) == 1)
+                fscanf(fp, "%c", &sep);
+            if (b + 1 > n)
+                n = b + 1;
+        }
+        fclose(fp);
+    }
+    if (n > 64)
+        n = 64;
+    __atomic_store_n(&nodes, n, __ATOMIC_RELAXED);
+    return n;
+}
+
+int shared_memory_numa_node()
+{
+    unsigned int cpu, node;
+    if (getcpu(&cpu, &node) != 0)
+        return 0;
+    return node;
+}
+
+int shared_memory_numa_bind(void *ptr, size_t len, int mode, uint64_t nodemask)
+{
+    static const int policy[] = {
+        [SHM_NUMA_DEFAULT] = 0,     // MPOL_DEFAULT
+        [SHM_NUMA_PREFERRED] = 1,   // MPOL_PREFERRED
+        [SHM_NUMA_BIND] = 2,        // MPOL_BIND
+        [SHM_NUMA_INTERLEAVE] = 3,  // MPOL_INTERLEAVE
+    };
+    if (mode < SHM_NUMA_DEFAULT || mode > SHM_NUMA_INTERLEAVE)
+        return -1;
+
+    int nodes = shared_memory_numa_nodes();
+    if (nodes < 64)
+        nodemask &= (1ull << nodes) - 1;
+    if (mode != SHM_NUMA_DEFAULT && nodemask == 0)
+        return -1;
+
+    // mbind range must be page aligned
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)ptr & ~(page - 1);
+    uintptr_t end = ((uintptr_t)ptr + len + page - 1) & ~(page - 1);
+    unsigned long mask = nodemask;
+    long r = syscall(SYS_mbind, start, end - start, policy[mode],
+                     mode == SHM_NUMA_DEFAULT ? NULL : &mask, mode == SHM_NUMA_DEFAULT ? 0 : 65, 0);
+    return r == 0 ? 0 : -1;
+}
+
+struct prefault_task {
+    uint8_t *begin;
+    uint8_t *end;
+    size_t pagesize;
+};
+
+static void *prefault_run(void *arg)
+{
+    struct prefault_task *task = arg;
+    // atomic add 0 cause a write fault but never change data written by others
+    for (uint8_t *p = task->begin; p < task->end; p += task->pagesize)
+        __atomic_fetch_add(p, 0, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+int shared_memory_prefault(shm_info_t *info, int threads)
+{
+    // prefault write every page
+    if (info->flags & SHM_FLAG_RDONLY)
+        return -1;
+    size_t pages = (info->size + info->pagesize - 1) / info->pagesize;
+    if (threads <= 0) {
+        // one thread for every 256MB is enough to hide the fault cost
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = info->size / (256 << 20) + 1;
+        if (cpus > 0 && threads > cpus)
+            threads = cpus;
+    }
+    if ((size_t)threads > pages)
+        threads = pages;
+    if (threads <= 1) {
+        struct prefault_task task = {info->ptr, (uint8_t *)info->ptr + info->size, info->pagesize};
+        prefault_run(&task);
+        return 0;
+    }
+
+    pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+    struct prefault_task *tasks = malloc(sizeof(struct prefault_task) * threads);
+    if (tids == NULL || tasks == NULL) {
+        free(tids);
+        free(tasks);
+        return -1;
+    }
+
+    int r = 0;
+    int started = 0;
+    uint8_t *begin = info->ptr;
+    for (int i = 0; i < threads; i++) {
+        size_t n = pages / threads + ((size_t)i < pages % threads);
+        tasks[i].begin = begin;
+        tasks[i].end = begin + n * info->pagesize;
+        if (tasks[i].end > (uint8_t *)info->ptr + info->size)
+            tasks[i].end = (uint8_t *)info->ptr + info->size;
+        tasks[i].pagesize = info->pagesize;
+        begin = tasks[i].end;
+
+        if (pthread_create(&tids[i], NULL, prefault_run, &tasks[i]) != 0) {
+            // touch it in this thread
+            prefault_run(&tasks[i]);
+            continue;
+        }
+        tids[started++] = tids[i];
+    }
+    for (int i = 0; i < started; i++) {
+        if (pthread_join(tids[i], NULL) != 0)
+            r = -1;
+    }
+
+    free(tids);
+    free(tasks);
+    return r;
+}
+
 void shared_memory_close(shm_info_t *info)
 {
     if (info->ptr != NULL)
@@ -80,7 +579,12 @@ void shared_memory_close(shm_info_t *info)
 
 int shared_memory_remove(const char *name)
 {
-    return shm_unlink(name);
+    char path[PATH_MAX];
+    if (shm_unlink(name) == 0)
+        return 0;
+    if (errno != ENOENT || hugetlbfs_path(name, path, sizeof(path)) != 0)
+        return -1;
+    return unlink(path);
 }
 
 int shm_lock_init(pthread_mutex_t *mutex)
@@ -0,0 +1,333 @@
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "shmutil.h"
+#include "shm_container.h"
+
+#define MAX_WORKERS 64
+#define MAX_IDS 1024
+#define MAX_KILLS 512
+#define MAX_PAYLOAD 200
+#define ELEMSIZE 64
+
+// a producer incarnation owns an id, so a respawned producer never reuse
+// a sequence number its killed predecessor may have put
+typedef struct {
+    uint32_t id;
+    uint32_t payload;
+    uint64_t seq;
+    int32_t offset;         // pool element holding the pattern of (id, seq)
+    uint32_t checksum;
+} stress_msg_t;
+
+typedef struct {
+    uint32_t done;          // all producers finished, consumers drain and exit
+    uint32_t reserve;
+    uint64_t received;
+    uint64_t duplicate;
+    uint64_t disorder;
+    uint64_t corrupt;
+    uint64_t produced[MAX_IDS];
+} stress_shared_t;
+
+typedef struct {
+    int producers;
+    int consumers;
+    long ops;
+    int kill_ms;
+    uint64_t bitmap_words;      // per id
+    stress_shared_t *shared;
+    shared_memory_pool_t *pool;
+    shared_queue_t *queue;
+    uint64_t *bitmap;
+} stress_t;
+
+static uint64_t xorshift(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static uint32_t checksum(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t msg_checksum(stress_msg_t *msg, const uint8_t *payload)
+{
+    uint32_t saved = msg->checksum;
+    msg->checksum = 0;
+    uint32_t h = checksum(msg, sizeof(*msg)) ^ checksum(payload, msg->payload);
+    msg->checksum = saved;
+    return h;
+}
+
+static uint64_t pattern(uint32_t id, uint64_t seq)
+{
+    return ((uint64_t)id << 40) ^ seq ^ 0x5a5a5a5a00000000ull;
+}
+
+static void producer(stress_t *st, uint32_t id, long ops, uint64_t seed)
+{
+    uint8_t buffer[sizeof(stress_msg_t) + MAX_PAYLOAD];
+    stress_msg_t *msg = (stress_msg_t *)buffer;
+    uint8_t *payload = buffer + sizeof(stress_msg_t);
+
+    for (uint64_t seq = 0; seq < (uint64_t)ops; seq++) {
+        // extra pool churn without a message
+        if (xorshift(&seed) % 8 == 0) {
+            void *p = shared_memory_pool_malloc(st->pool);
+            if (p != NULL)
+                shared_memory_pool_free(st->pool, p);
+        }
+
+        uint64_t *elem;
+        while ((elem = shared_memory_pool_malloc(st->pool)) == NULL)
+            sched_yield();
+        for (int i = 0; i < ELEMSIZE / 8; i++)
+            elem[i] = pattern(id, seq);
+
+        msg->id = id;
+        msg->seq = seq;
+        msg->offset = shared_memory_pool_offset(st->pool, elem);
+        msg->payload = xorshift(&seed) % MAX_PAYLOAD;
+        for (uint32_t i = 0; i < msg->payload; i++)
+            payload[i] = seq + i;
+        msg->checksum = msg_checksum(msg, payload);
+
+        while (shared_queue_put(st->queue, buffer, sizeof(stress_msg_t) + msg->payload) <= 0)
+            sched_yield();
+        // killed before this line, seq is put but not counted as produced
+        __atomic_store_n(&st->shared->produced[id], seq + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void consumer(stress_t *st, uint64_t seed)
+{
+    uint8_t buffer[sizeof(stress_msg_t) + MAX_PAYLOAD];
+    stress_msg_t *msg = (stress_msg_t *)buffer;
+    uint8_t *payload = buffer + sizeof(stress_msg_t);
+    int64_t *last = malloc(sizeof(int64_t) * MAX_IDS);
+    for (int i = 0; i < MAX_IDS; i++)
+        last[i] = -1;
+
+    while (1) {
+        int len = shared_queue_get(st->queue, buffer, sizeof(buffer));
+        if (len == 0) {
+            if (__atomic_load_n(&st->shared->done, __ATOMIC_ACQUIRE))
+                break;
+            sched_yield();
+            continue;
+        }
+        if (len < (int)sizeof(stress_msg_t) || len != (int)(sizeof(stress_msg_t) + msg->payload) ||
+            msg->id >= MAX_IDS || msg->seq >= st->bitmap_words * 64 || msg_checksum(msg, payload) != msg->checksum) {
+            __atomic_add_fetch(&st->shared->corrupt, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        uint64_t *elem = shared_memory_pool_pointer(st->pool, msg->offset);
+        int bad = elem == NULL;
+        for (int i = 0; !bad && i < ELEMSIZE / 8; i++)
+            bad = elem[i] != pattern(msg->id, msg->seq);
+        if (bad)
+            __atomic_add_fetch(&st->shared->corrupt, 1, __ATOMIC_RELAXED);
+        if (elem != NULL)
+            shared_memory_pool_free(st->pool, elem);
+
+        // queue is fifo, one consumer sees each producer in order
+        if ((int64_t)msg->seq <= last[msg->id])
+            __atomic_add_fetch(&st->shared->disorder, 1, __ATOMIC_RELAXED);
+        last[msg->id] = msg->seq;
+
+        uint64_t *word = &st->bitmap[msg->id * st->bitmap_words + msg->seq / 64];
+        if (__atomic_fetch_or(word, 1ull << (msg->seq % 64), __ATOMIC_RELAXED) & (1ull << (msg->seq % 64)))
+            __atomic_add_fetch(&st->shared->duplicate, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&st->shared->received, 1, __ATOMIC_RELAXED);
+
+        if (xorshift(&seed) % 64 == 0)
+            sched_yield();
+    }
+    free(last);
+}
+
+typedef struct {
+    pid_t pid;
+    int producer;       // 1 producer, 0 consumer
+    uint32_t id;
+    long remaining;     // producer ops left for the slot
+} worker_t;
+
+static uint32_t next_id = 0;
+
+static void spawn(stress_t *st, worker_t *w, uint64_t seed)
+{
+    if (w->producer)
+        w->id = next_id++;
+    w->pid = fork();
+    if (w->pid == 0) {
+        if (w->producer)
+            producer(st, w->id, w->remaining, seed | 1);
+        else
+            consumer(st, seed | 1);
+        _exit(0);
+    }
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-p producers] [-c consumers] [-n ops] [-k kill_ms] [-s seed]\n"
+           "  -p  producer processes, default 4\n"
+           "  -c  consumer processes, default 4\n"
+           "  -n  messages per producer, default 100000\n"
+           "  -k  SIGKILL a random worker every kill_ms and respawn it, default 0 off\n"
+           "  -s  random seed, default time\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    stress_t st = {0};
+    st.producers = 4;
+    st.consumers = 4;
+    st.ops = 100000;
+    uint64_t seed = time(NULL);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:c:n:k:s:h")) != -1) {
+        switch (opt) {
+        case 'p': st.producers = atoi(optarg); break;
+        case 'c': st.consumers = atoi(optarg); break;
+        case 'n': st.ops = atol(optarg); break;
+        case 'k': st.kill_ms = atoi(optarg); break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : -1;
+        }
+    }
+    int nworkers = st.producers + st.consumers;
+    if (st.producers <= 0 || st.consumers <= 0 || nworkers > MAX_WORKERS || st.ops <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    printf("producers=%d consumers=%d ops=%ld kill_ms=%d seed=%llu\n", st.producers, st.consumers, st.ops,
+           st.kill_ms, (unsigned long long)seed);
+
+    // small queue keep it full or empty most of the time, pool has room
+    // for the elements leaked by killed workers
+    int32_t count = nworkers * 4 + MAX_KILLS;
+    size_t qsize = 16 * (sizeof(stress_msg_t) + MAX_PAYLOAD);
+    st.bitmap_words = (st.ops + 63) / 64;
+    size_t pool_pos = (sizeof(stress_shared_t) + 63) & ~63ul;
+    size_t queue_pos = pool_pos + ((shared_memory_pool_size(ELEMSIZE, count, 64) + 63) & ~63ul);
+    size_t bitmap_pos = queue_pos + ((shared_queue_size(qsize) + 63) & ~63ul);
+    size_t size = bitmap_pos + sizeof(uint64_t) * st.bitmap_words * MAX_IDS;
+
+    shm_info_t *shm = shared_memory_create_anon("shm_stress", size, 0);
+    if (shm == NULL) {
+        printf("create shared memory fail\n");
+        return -1;
+    }
+    st.shared = shm->ptr;
+    st.pool = shared_memory_pool_create((uint8_t *)shm->ptr + pool_pos, ELEMSIZE, count, 64);
+    st.queue = shared_queue_create((uint8_t *)shm->ptr + queue_pos, qsize);
+    st.bitmap = (uint64_t *)((uint8_t *)shm->ptr + bitmap_pos);
+
+    worker_t workers[MAX_WORKERS];
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].producer = i < st.producers;
+        workers[i].remaining = st.ops;
+        spawn(&st, &workers[i], xorshift(&seed));
+    }
+
+    uint64_t kills = 0, consumer_kills = 0;
+    int running = st.producers;
+    while (running > 0) {
+        if (st.kill_ms > 0)
+            usleep(st.kill_ms * 1000);
+        else
+            usleep(10000);
+
+        for (int i = 0; i < st.producers; i++) {
+            worker_t *w = &workers[i];
+            if (w->pid > 0 && waitpid(w->pid, NULL, WNOHANG) == w->pid) {
+                w->pid = 0;
+                running--;
+            }
+        }
+        if (st.kill_ms <= 0 || running == 0 || kills >= MAX_KILLS)
+            continue;
+
+        worker_t *w = &workers[xorshift(&seed) % nworkers];
+        if (w->pid <= 0 || (w->producer && next_id >= MAX_IDS))
+            continue;
+        kill(w->pid, SIGKILL);
+        waitpid(w->pid, NULL, 0);
+        kills++;
+        if (w->producer) {
+            uint64_t done = __atomic_load_n(&st.shared->produced[w->id], __ATOMIC_ACQUIRE);
+            w->remaining -= done;
+            if (w->remaining <= 0) {
+                w->pid = 0;
+                running--;
+                continue;
+            }
+        } else {
+            consumer_kills++;
+        }
+        spawn(&st, w, xorshift(&seed));
+    }
+
+    __atomic_store_n(&st.shared->done, 1, __ATOMIC_RELEASE);
+    for (int i = st.producers; i < nworkers; i++)
+        waitpid(workers[i].pid, NULL, 0);
+
+    // seq below produced must arrive, a killed consumer may lose the one
+    // message it was holding, seq == produced may come from a killed producer
+    uint64_t lost = 0, unexpected = 0, produced = 0;
+    for (uint32_t id = 0; id < next_id; id++) {
+        uint64_t n = st.shared->produced[id];
+        produced += n;
+        for (uint64_t seq = 0; seq < st.bitmap_words * 64; seq++) {
+            int got = (st.bitmap[id * st.bitmap_words + seq / 64] >> (seq % 64)) & 1;
+            if (seq < n && !got)
+                lost++;
+            else if (seq > n && got)
+                unexpected++;
+        }
+    }
+
+    shared_memory_pool_stat_t ps;
+    shared_memory_pool_stat(st.pool, &ps);
+    shared_queue_stat_t qs;
+    shared_queue_stat(st.queue, &qs);
+    // producers and consumers killed between malloc and free leak an element
+    int pool_bad = ps.free_count < 0 || ps.free_count + ps.use_count != ps.count || (uint64_t)ps.use_count > kills;
+    int queue_bad = qs.records != 0;
+
+    printf("produced=%llu received=%llu kills=%llu lost=%llu duplicate=%llu disorder=%llu corrupt=%llu "
+           "unexpected=%llu pool_leak=%d pool=%s queue=%s\n",
+           (unsigned long long)produced, (unsigned long long)st.shared->received, (unsigned long long)kills,
+           (unsigned long long)lost, (unsigned long long)st.shared->duplicate,
+           (unsigned long long)st.shared->disorder, (unsigned long long)st.shared->corrupt,
+           (unsigned long long)unexpected, ps.use_count, pool_bad ? "bad" : "ok", queue_bad ? "bad" : "ok");
+
+    int fail = lost > consumer_kills || st.shared->duplicate != 0 || st.shared->disorder != 0 ||
+               st.shared->corrupt != 0 || unexpected != 0 || pool_bad || queue_bad;
+    printf("%s\n", fail ? "FAIL" : "PASS");
+    shared_memory_close(shm);
+    return fail ? 1 : 0;
+}
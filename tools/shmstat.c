@@ -0,0 +1,271 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmutil.h"
+#include "shm_container.h"
+#include "shm_directory.h"
+#include "shm_lock.h"
+#include "shm_rpc.h"
+
+#define MAX_OBJECTS 256
+
+// last sample of every object, for rates in watch mode
+typedef struct {
+    const void *ptr;
+    int64_t used;
+} last_sample_t;
+
+static last_sample_t samples[MAX_OBJECTS];
+static int nsamples = 0;
+static double interval = 0;
+
+// change of used count or bytes per second since last round
+static double sample_rate(const void *ptr, int64_t used)
+{
+    for (int i = 0; i < nsamples; i++) {
+        if (samples[i].ptr == ptr) {
+            double rate = interval > 0 ? (used - samples[i].used) / interval : 0;
+            samples[i].used = used;
+            return rate;
+        }
+    }
+    if (nsamples < MAX_OBJECTS) {
+        samples[nsamples].ptr = ptr;
+        samples[nsamples].used = used;
+        nsamples++;
+    }
+    return 0;
+}
+
+static void print_lock(uint32_t owner, uint32_t waiters)
+{
+    if (owner == 0)
+        printf("  lock=free");
+    else
+        printf("  lock=tid:%u%s", owner, waiters ? ",waiters" : "");
+}
+
+static void print_pool(const char *name, const shared_memory_pool_t *pool)
+{
+    shared_memory_pool_stat_t st;
+    shared_memory_pool_stat(pool, &st);
+    printf("%-24s pool   elemsize=%d used=%d/%d free_list=", name, st.elemsize, st.use_count, st.count);
+    if (st.free_count < 0)
+        printf("changing");
+    else
+        printf("%d", st.free_count);
+    if (st.layout & SHM_POOL_INTRUSIVE)
+        printf(" intrusive");
+    else if (st.layout & SHM_POOL_BITMAP)
+        printf(" bitmap");
+    if (st.layout & SHM_POOL_COLOR)
+        printf(" color");
+    print_lock(st.lock_owner, st.lock_waiters);
+    if (interval > 0)
+        printf("  used/s=%+.0f", sample_rate(pool, st.use_count));
+    printf("\n");
+}
+
+static void print_queue(const char *name, const shared_queue_t *queue)
+{
+    shared_queue_stat_t st;
+    shared_queue_stat(queue, &st);
+    int32_t used = st.writepos - st.readpos;
+    printf("%-24s queue  size=%zu used=%d (%.1f%%) records=", name, st.size, used,
+           st.size > 0 ? 100.0 * used / st.size : 0);
+    if (st.records < 0)
+        printf("changing");
+    else
+        printf("%d", st.records);
+    printf(" readpos=%d writepos=%d", st.readpos, st.writepos);
+    print_lock(st.lock_owner, st.lock_waiters);
+    if (interval > 0)
+        printf("  bytes/s=%+.0f", sample_rate(queue, used));
+    printf("\n");
+}
+
+static void print_shard(const char *name, shared_memory_shard_t *shard)
+{
+    printf("%-24s shard  elemsize=%d count=%d nshards=%d\n", name, shard->elemsize, shard->count, shard->nshards);
+    for (int32_t i = 0; i < shard->nshards; i++) {
+        char label[64];
+        snprintf(label, sizeof(label), "  %s[%d]", name, i);
+        print_pool(label, shared_memory_shard_pool(shard, i));
+    }
+}
+
+static void print_rwlock(const char *name, const shm_rwlock_t *lock)
+{
+    uint32_t readers = 0;
+    for (uint32_t i = 0; i < lock->nslots; i++)
+        readers += __atomic_load_n(&lock->slots[i].count, __ATOMIC_RELAXED);
+    uint32_t writer = __atomic_load_n(&lock->writer, __ATOMIC_RELAXED);
+    printf("%-24s rwlock slots=%u readers=%u writer=%s\n", name, lock->nslots, readers,
+           writer == 0 ? "free" : writer == 1 ? "held" : "held,waiters");
+}
+
+static void print_rpc(const char *name, shm_rpc_t *rpc)
+{
+    int32_t attached = 0;
+    for (int32_t i = 0; i < rpc->nslots; i++) {
+        shm_rpc_slot_t *s = (shm_rpc_slot_t *)((uint8_t *)rpc + rpc->slotpos + rpc->slot_size * i);
+        attached += __atomic_load_n(&s->owner, __ATOMIC_RELAXED) != 0;
+    }
+    uint64_t head = __atomic_load_n(&rpc->head, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&rpc->tail, __ATOMIC_RELAXED);
+    printf("%-24s rpc    msgsize=%d callers=%d/%d queued=%llu servers_parked=%u", name, rpc->msgsize, attached,
+           rpc->nslots, (unsigned long long)(tail - head), __atomic_load_n(&rpc->pending.waiters, __ATOMIC_RELAXED));
+    if (interval > 0)
+        printf("  calls/s=%.0f", sample_rate(rpc, tail));
+    printf("\n");
+}
+
+// recognize object by its magic flag, return 0 if unknown
+static int print_object(const char *name, void *ptr, size_t size)
+{
+    shared_memory_pool_t *pool;
+    shared_queue_t *queue;
+    shared_memory_shard_t *shard;
+    shared_memory_chain_t *chain;
+    shm_rwlock_t *lock;
+    shm_rpc_t *rpc;
+
+    if (size >= sizeof(shared_memory_pool_t) && (pool = shared_memory_pool_open(ptr)) != NULL) {
+        print_pool(name, pool);
+    } else if (size >= sizeof(shared_queue_t) && (queue = shared_queue_open(ptr)) != NULL) {
+        print_queue(name, queue);
+    } else if (size >= sizeof(shared_memory_shard_t) && (shard = shared_memory_shard_open(ptr)) != NULL) {
+        print_shard(name, shard);
+    } else if (size >= shared_memory_chain_size() && (chain = shared_memory_chain_open(ptr)) != NULL) {
+        shared_memory_chain_header_t *h = chain->header;
+        printf("%-24s chain  elemsize=%d used=%d/%d chunks=%d/%d\n", name, h->elemsize,
+               __atomic_load_n(&h->use_count, __ATOMIC_RELAXED), __atomic_load_n(&h->count, __ATOMIC_RELAXED),
+               h->nchunks, h->max_chunks);
+        shared_memory_chain_close(chain);
+    } else if (size >= sizeof(shm_rwlock_t) && (lock = shm_rwlock_open(ptr)) != NULL) {
+        print_rwlock(name, lock);
+    } else if (size >= sizeof(shm_rpc_t) && (rpc = shm_rpc_open(ptr)) != NULL) {
+        print_rpc(name, rpc);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static int print_segment(shm_info_t *shm, long offset)
+{
+    uint8_t *base = shm->ptr;
+    size_t size = shm->size;
+    if (shm->flags & SHM_FLAG_GROWABLE) {
+        base = shared_memory_data(shm);
+        size -= sizeof(shm_segment_t);
+    }
+
+    if (offset >= 0) {
+        if ((size_t)offset >= size || !print_object("object", base + offset, size - offset)) {
+            printf("no known object at offset %ld\n", offset);
+            return -1;
+        }
+        return 0;
+    }
+
+    shared_directory_t *dir = size >= sizeof(shared_directory_t) ? shared_directory_open(base) : NULL;
+    if (dir == NULL) {
+        if (!print_object("segment", base, size)) {
+            printf("no known object at segment start, try --offset\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    // a corrupt or foreign directory must not lead reads past the mapping
+    if (dir->capacity <= 0 ||
+        (size_t)dir->capacity > (size - sizeof(shared_directory_t)) / sizeof(shared_directory_entry_t)) {
+        printf("directory  capacity=%d beyond segment size %zu\n", dir->capacity, size);
+        return -1;
+    }
+
+    printf("directory  objects=%d/%d used=%llu/%llu ready=%s\n", dir->count, dir->capacity,
+           (unsigned long long)__atomic_load_n(&dir->top, __ATOMIC_RELAXED), (unsigned long long)dir->size,
+           __atomic_load_n(&dir->ready.state, __ATOMIC_RELAXED) == SHM_ONCE_READY ? "yes" : "no");
+    for (int32_t i = 0; i < dir->capacity; i++) {
+        shared_directory_entry_t *e = &dir->entries[i];
+        if (__atomic_load_n(&e->hash, __ATOMIC_ACQUIRE) == 0)
+            continue;
+        char name[SHM_OBJECT_NAME_SIZE];
+        memcpy(name, e->name, sizeof(name));
+        name[sizeof(name) - 1] = '\0';
+        int inside = e->offset <= size && e->size <= size - e->offset;
+        if (!inside || !print_object(name, base + e->offset, e->size))
+            printf("%-24s %s type=%u version=%u offset=%llu size=%llu\n", name, inside ? "user  " : "broken",
+                   e->type, e->version, (unsigned long long)e->offset, (unsigned long long)e->size);
+    }
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [--watch [seconds]] [--offset bytes] name\n"
+           "  attach read only, print pools, queues, locks and rpc channels without taking them\n"
+           "  -w, --watch   print again every seconds, default 1, with rates\n"
+           "  -o, --offset  object offset in segment, default the directory or segment start\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option options[] = {
+        {"watch", optional_argument, NULL, 'w'},
+        {"offset", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    double watch = 0;
+    long offset = -1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "w::o:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'w':
+            // allow "--watch 2" as well as "--watch=2"
+            if (optarg == NULL && optind < argc - 1 && atof(argv[optind]) > 0)
+                optarg = argv[optind++];
+            watch = optarg != NULL ? atof(optarg) : 1;
+            break;
+        case 'o': offset = atol(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc - 1 || watch < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    shm_info_t *shm = shared_memory_open_ex(argv[optind], SHM_FLAG_RDONLY);
+    if (shm == NULL) {
+        printf("open %s error\n", argv[optind]);
+        return -1;
+    }
+
+    int r;
+    struct timespec last, now;
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    while (1) {
+        if (shm->flags & SHM_FLAG_GROWABLE)
+            shared_memory_remap(shm);
+        r = print_segment(shm, offset);
+        if (watch <= 0 || r != 0)
+            break;
+        fflush(stdout);
+        usleep(watch * 1000000);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        interval = (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9;
+        last = now;
+        printf("\n");
+    }
+
+    shared_memory_close(shm);
+    return r;
+}
@@ -1,5 +1,11 @@
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
 #include "utest.h"
 #include "shm_container.h"
+#include "shm_trace.h"
 
 static void memory_set_value(void *ptr, size_t sz, uint8_t value) {
     memset(ptr, value, sz);
@@ -90,6 +96,32 @@ UTEST(shared_memory_pool, error_value)
     free(data);
 }
 
+UTEST(shared_memory_pool, offset_exact)
+{
+    // power of two, odd and even non power of two element sizes
+    int32_t sizes[] = {1, 8, 64, 4096, 24, 40, 1200, 1000};
+    int32_t count = 50;
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        int32_t elemsize = sizes[k];
+        uint8_t *data = malloc(shared_memory_pool_size(elemsize, count, 1));
+        shared_memory_pool_t *pool = shared_memory_pool_create(data, elemsize, count, 1);
+        uint8_t *base = data + shared_memory_pool_size(elemsize, count, 1) - (size_t)elemsize * count;
+
+        for (int32_t i = 0; i < count; i++) {
+            EXPECT_EQ(shared_memory_pool_offset(pool, base + (size_t)i * elemsize), i);
+            if (elemsize > 1)
+                EXPECT_EQ(shared_memory_pool_offset(pool, base + (size_t)i * elemsize + 1), -1);
+        }
+        EXPECT_EQ(shared_memory_pool_offset(pool, base - elemsize), -1);
+        EXPECT_EQ(shared_memory_pool_offset(pool, base + (size_t)count * elemsize), -1);
+        EXPECT_EQ(shared_memory_pool_offset(pool, NULL), -1);
+        free(data);
+    }
+
+    // element area bigger than 2GB must not overflow int32
+    EXPECT_TRUE(shared_memory_pool_size(1 << 20, 4096, 8) > ((size_t)4096 << 20));
+}
+
 UTEST(shared_memory_pool, align)
 {
     int32_t elemsize = 1200;
@@ -104,4 +136,581 @@ UTEST(shared_memory_pool, align)
     }
 
     free(data);
-}
\ No newline at end of file
+}
+UTEST(shared_memory_pool, intrusive)
+{
+    int32_t elemsize = 64;
+    int32_t count = 1000;
+    // header and meta: 48 + 4 * 1000 -> 4096, 48 + 1000 / 8 -> 192
+    EXPECT_EQ(shared_memory_pool_size(elemsize, count, 64) -
+              shared_memory_pool_size_ex(elemsize, count, 64, SHM_POOL_INTRUSIVE), (size_t)(4096 - 192));
+    EXPECT_TRUE(shared_memory_pool_create_ex(NULL, elemsize, count, 64, 0x80000000) == NULL);
+
+    size_t size = shared_memory_pool_size_ex(elemsize, count, 64, SHM_POOL_INTRUSIVE);
+    void *data = aligned_alloc(64, size);
+    shared_memory_pool_t *pool = shared_memory_pool_create_ex(data, elemsize, count, 64, SHM_POOL_INTRUSIVE);
+    ASSERT_TRUE(pool != NULL);
+
+    uint8_t *ptrs[1000];
+    for (int i = 0; i < count; i++) {
+        ptrs[i] = shared_memory_pool_malloc(pool);
+        ASSERT_TRUE(ptrs[i] != NULL);
+        EXPECT_TRUE((uint8_t *)ptrs[i] + elemsize <= (uint8_t *)data + size);
+        EXPECT_EQ(shared_memory_pool_offset(pool, ptrs[i]), i);
+        memory_set_value(ptrs[i], elemsize, 0xee);
+    }
+    EXPECT_TRUE(shared_memory_pool_malloc(pool) == NULL);
+    EXPECT_EQ(pool->use_count, count);
+
+    for (int i = 0; i < count; i += 2)
+        shared_memory_pool_free(pool, ptrs[i]);
+    // double free is ignored
+    shared_memory_pool_free(pool, ptrs[0]);
+    EXPECT_EQ(pool->use_count, count / 2);
+    for (int i = 0; i < count; i++)
+        EXPECT_TRUE(shared_memory_pool_pointer(pool, i) == (i % 2 ? ptrs[i] : NULL));
+    for (int i = 1; i < count; i += 2)
+        EXPECT_TRUE(memory_check_value(ptrs[i], elemsize, 0xee));
+
+    shared_memory_pool_stat_t st;
+    shared_memory_pool_stat(pool, &st);
+    EXPECT_EQ(st.layout, (uint32_t)SHM_POOL_INTRUSIVE);
+    EXPECT_EQ(st.free_count, count / 2);
+
+    shared_memory_pool_clear(pool);
+    EXPECT_EQ(pool->use_count, 0);
+    EXPECT_TRUE(shared_memory_pool_pointer(pool, 1) == NULL);
+    EXPECT_TRUE(shared_memory_pool_malloc(pool) == ptrs[0]);
+    free(data);
+
+    // a free element must hold the next index
+    data = malloc(shared_memory_pool_size_ex(1, 10, 1, SHM_POOL_INTRUSIVE));
+    pool = shared_memory_pool_create_ex(data, 1, 10, 1, SHM_POOL_INTRUSIVE);
+    EXPECT_EQ(pool->elemsize, 4);
+    for (int i = 0; i < 10; i++)
+        EXPECT_TRUE(shared_memory_pool_malloc(pool) != NULL);
+    free(data);
+}
+
+UTEST(shared_memory_pool, open_layout)
+{
+    size_t size = shared_memory_pool_size_ex(64, 10, 8, SHM_POOL_BITMAP);
+    void *data = aligned_alloc(64, size);
+    shared_memory_pool_t *pool = shared_memory_pool_create_ex(data, 64, 10, 8, SHM_POOL_BITMAP);
+    ASSERT_TRUE(pool != NULL);
+    EXPECT_TRUE(shared_memory_pool_open(data) == pool);
+
+    // unknown layout bits are refused
+    pool->layout |= 0x100;
+    EXPECT_TRUE(shared_memory_pool_open(data) == NULL);
+    pool->layout = SHM_POOL_INTRUSIVE | SHM_POOL_BITMAP;
+    EXPECT_TRUE(shared_memory_pool_open(data) == NULL);
+    free(data);
+
+    // default layout pool keep its flag, a layout on it is refused
+    size = shared_memory_pool_size(64, 10, 8);
+    data = aligned_alloc(64, size);
+    pool = shared_memory_pool_create(data, 64, 10, 8);
+    EXPECT_TRUE(shared_memory_pool_open(data) == pool);
+    pool->layout = SHM_POOL_COLOR;
+    EXPECT_TRUE(shared_memory_pool_open(data) == NULL);
+    free(data);
+}
+
+UTEST(shared_memory_pool, bitmap_malloc_n)
+{
+    int32_t elemsize = 32;
+    int32_t count = 1000;
+    size_t size = shared_memory_pool_size_ex(elemsize, count, 8, SHM_POOL_BITMAP);
+    void *data = aligned_alloc(64, size);
+    EXPECT_TRUE(shared_memory_pool_create_ex(data, elemsize, count, 8, SHM_POOL_BITMAP | SHM_POOL_INTRUSIVE) == NULL);
+    shared_memory_pool_t *pool = shared_memory_pool_create_ex(data, elemsize, count, 8, SHM_POOL_BITMAP);
+    ASSERT_TRUE(pool != NULL);
+
+    uint8_t *a = shared_memory_pool_malloc_n(pool, 3);
+    uint8_t *b = shared_memory_pool_malloc(pool);
+    uint8_t *c = shared_memory_pool_malloc_n(pool, 200);
+    ASSERT_TRUE(a != NULL && b != NULL && c != NULL);
+    EXPECT_EQ(shared_memory_pool_offset(pool, a), 0);
+    EXPECT_EQ(shared_memory_pool_offset(pool, b), 3);
+    EXPECT_EQ(shared_memory_pool_offset(pool, c), 4);
+    EXPECT_EQ(pool->use_count, 204);
+    EXPECT_TRUE(shared_memory_pool_malloc_n(pool, count) == NULL);
+    EXPECT_TRUE(shared_memory_pool_malloc_n(pool, 0) == NULL);
+
+    // only the first element of a run is a pointer and can be freed
+    EXPECT_TRUE(shared_memory_pool_pointer(pool, 0) == a);
+    EXPECT_TRUE(shared_memory_pool_pointer(pool, 1) == NULL);
+    EXPECT_TRUE(shared_memory_pool_pointer(pool, 4) == c);
+    shared_memory_pool_free(pool, a + elemsize);
+    EXPECT_EQ(pool->use_count, 204);
+
+    // the run is released as a whole, a hole of 3 takes 3 but not 4
+    shared_memory_pool_free(pool, a);
+    EXPECT_EQ(pool->use_count, 201);
+    EXPECT_EQ(shared_memory_pool_offset(pool, shared_memory_pool_malloc_n(pool, 4)), 204);
+    EXPECT_EQ(shared_memory_pool_offset(pool, shared_memory_pool_malloc_n(pool, 3)), 0);
+    shared_memory_pool_free(pool, c);
+    EXPECT_EQ(pool->use_count, 8);
+
+    shared_memory_pool_stat_t st;
+    shared_memory_pool_stat(pool, &st);
+    EXPECT_EQ(st.layout, (uint32_t)SHM_POOL_BITMAP);
+    EXPECT_EQ(st.free_count, count - 8);
+
+    // fill with single elements, every other free leave no pair
+    shared_memory_pool_clear(pool);
+    uint8_t *ptrs[1000];
+    for (int i = 0; i < count; i++) {
+        ptrs[i] = shared_memory_pool_malloc(pool);
+        ASSERT_TRUE(ptrs[i] != NULL);
+        EXPECT_EQ(shared_memory_pool_offset(pool, ptrs[i]), i);
+    }
+    EXPECT_TRUE(shared_memory_pool_malloc(pool) == NULL);
+    for (int i = 0; i < count; i += 2)
+        shared_memory_pool_free(pool, ptrs[i]);
+    EXPECT_TRUE(shared_memory_pool_malloc_n(pool, 2) == NULL);
+    shared_memory_pool_free(pool, ptrs[901]);
+    EXPECT_TRUE(shared_memory_pool_malloc_n(pool, 3) == ptrs[900]);
+    EXPECT_TRUE(shared_memory_pool_malloc(pool) == ptrs[0]);
+    free(data);
+
+    // other layouts only malloc one
+    data = malloc(shared_memory_pool_size(elemsize, 10, 8));
+    pool = shared_memory_pool_create(data, elemsize, 10, 8);
+    EXPECT_TRUE(shared_memory_pool_malloc_n(pool, 2) == NULL);
+    EXPECT_TRUE(shared_memory_pool_malloc_n(pool, 1) != NULL);
+    free(data);
+}
+
+UTEST(shared_memory_pool, color)
+{
+    int32_t count = 128;
+    uint32_t layouts[3] = {SHM_POOL_COLOR, SHM_POOL_COLOR | SHM_POOL_INTRUSIVE, SHM_POOL_COLOR | SHM_POOL_BITMAP};
+    for (int l = 0; l < 3; l++) {
+        size_t size = shared_memory_pool_size_ex(4096, count, 64, layouts[l]);
+        void *data = aligned_alloc(64, size);
+        shared_memory_pool_t *pool = shared_memory_pool_create_ex(data, 4096, count, 64, layouts[l]);
+        ASSERT_TRUE(pool != NULL);
+        EXPECT_EQ(pool->elemsize, 4096 + 64);
+
+        // 64 consecutive elements start at 64 different sets of a 4KB way
+        uint64_t sets = 0;
+        for (int i = 0; i < count; i++) {
+            uint8_t *p = shared_memory_pool_malloc(pool);
+            ASSERT_TRUE(p != NULL);
+            EXPECT_TRUE((uintptr_t)p % 64 == 0);
+            EXPECT_TRUE(p + pool->elemsize <= (uint8_t *)data + size);
+            EXPECT_EQ(shared_memory_pool_offset(pool, p), i);
+            EXPECT_EQ(shared_memory_pool_offset(pool, p + 64), -1);
+            EXPECT_TRUE(shared_memory_pool_pointer(pool, i) == p);
+            if (i < 64)
+                sets |= 1ull << ((uintptr_t)p / 64 % 64);
+        }
+        EXPECT_EQ(sets, UINT64_MAX);
+        free(data);
+    }
+
+    // odd line count, small element and big align stay as they are
+    void *data = aligned_alloc(128, shared_memory_pool_size_ex(1088, 4, 128, SHM_POOL_COLOR));
+    EXPECT_EQ(shared_memory_pool_create_ex(data, 1088, 4, 64, SHM_POOL_COLOR)->elemsize, 1088);
+    EXPECT_EQ(shared_memory_pool_create_ex(data, 1000, 4, 8, SHM_POOL_COLOR)->elemsize, 1088);
+    EXPECT_EQ(shared_memory_pool_create_ex(data, 100, 4, 8, SHM_POOL_COLOR)->elemsize, 104);
+    EXPECT_EQ(shared_memory_pool_create_ex(data, 1024, 4, 128, SHM_POOL_COLOR)->elemsize, 1024);
+    free(data);
+}
+
+UTEST(shared_memory_chain, grow)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/shm_chain_test_%d", (int)getpid());
+
+    int32_t elemsize = 100;
+    int32_t chunk_count = 10;
+    int32_t max_chunks = 4;
+    void *data = malloc(shared_memory_chain_size());
+    shared_memory_chain_t *chain = shared_memory_chain_create(data, name, elemsize, chunk_count, max_chunks, 8);
+    ASSERT_TRUE(chain != NULL);
+    EXPECT_EQ(chain->header->count, 0);
+
+    int32_t offset[40];
+    for (int i = 0; i < 40; i++) {
+        void *ptr = shared_memory_chain_malloc(chain);
+        ASSERT_TRUE(ptr != NULL);
+        memory_set_value(ptr, elemsize, i);
+        offset[i] = shared_memory_chain_offset(chain, ptr);
+        EXPECT_TRUE(offset[i] >= 0);
+    }
+    EXPECT_TRUE(shared_memory_chain_malloc(chain) == NULL);
+    EXPECT_EQ(chain->header->count, 40);
+    EXPECT_EQ(chain->header->use_count, 40);
+
+    // other process open chunks lazily
+    shared_memory_chain_t *other = shared_memory_chain_open(data);
+    ASSERT_TRUE(other != NULL);
+    for (int i = 0; i < 40; i++) {
+        void *ptr = shared_memory_chain_pointer(other, offset[i]);
+        ASSERT_TRUE(ptr != NULL);
+        EXPECT_EQ(memory_check_value(ptr, elemsize, i), 1);
+        EXPECT_EQ(shared_memory_chain_offset(other, ptr), offset[i]);
+        shared_memory_chain_free(other, ptr);
+    }
+    EXPECT_EQ(chain->header->use_count, 0);
+    EXPECT_TRUE(shared_memory_chain_pointer(chain, offset[0]) == NULL);
+
+    // free list span all chunks
+    for (int i = 0; i < 40; i++)
+        EXPECT_TRUE(shared_memory_chain_malloc(chain) != NULL);
+    EXPECT_EQ(chain->header->count, 40);
+
+    shared_memory_chain_close(other);
+    shared_memory_chain_remove(chain);
+    shared_memory_chain_close(chain);
+    free(data);
+}
+
+UTEST(shared_memory_chain, owner_dead)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/shm_chain_dead_%d", (int)getpid());
+
+    int32_t chunk_count = 10;
+    size_t size = shared_memory_chain_size();
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    shared_memory_chain_t *chain = shared_memory_chain_create(data, name, 64, chunk_count, 2, 8);
+    ASSERT_TRUE(chain != NULL);
+    ASSERT_TRUE(shared_memory_chain_malloc(chain) != NULL);
+
+    // die in the middle of malloc, element is popped but not marked
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_lock_acquire(&chain->header->mutex);
+        int32_t *meta = chain->chunks[0]->ptr;
+        chain->header->first = meta[chain->header->first];
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    // lost element is found again, no new chunk
+    for (int i = 0; i < chunk_count - 1; i++)
+        EXPECT_TRUE(shared_memory_chain_malloc(chain) != NULL);
+    EXPECT_EQ(chain->header->use_count, chunk_count);
+    EXPECT_EQ(chain->header->nchunks, 1);
+
+    shared_memory_chain_remove(chain);
+    shared_memory_chain_close(chain);
+    munmap(data, size);
+}
+
+UTEST(shared_memory_shard, steal)
+{
+    int32_t elemsize = 64;
+    int32_t count = 20;
+    int32_t nshards = 3;
+    size_t size = shared_memory_shard_size(elemsize, count, nshards, 8);
+    void *data = aligned_alloc(4096, size);
+    shared_memory_shard_t *shard = shared_memory_shard_create(data, elemsize, count, nshards, 8);
+    ASSERT_TRUE(shard != NULL);
+    EXPECT_EQ(shard->count, 60);
+    EXPECT_TRUE(shared_memory_shard_open(data) == shard);
+
+    // local shard first, then steal from others
+    int32_t local = shared_memory_numa_node() % nshards;
+    int32_t offset[60];
+    for (int i = 0; i < 60; i++) {
+        void *ptr = shared_memory_shard_malloc(shard);
+        ASSERT_TRUE(ptr != NULL);
+        memory_set_value(ptr, elemsize, i);
+        offset[i] = shared_memory_shard_offset(shard, ptr);
+        EXPECT_TRUE(offset[i] >= 0);
+        int32_t id = offset[i] >> SHM_SHARD_INDEX_BITS;
+        if (i < count)
+            EXPECT_EQ(id, local);
+    }
+    EXPECT_TRUE(shared_memory_shard_malloc(shard) == NULL);
+    for (int i = 0; i < nshards; i++)
+        EXPECT_EQ(shared_memory_shard_pool(shard, i)->use_count, count);
+
+    for (int i = 0; i < 60; i++) {
+        void *ptr = shared_memory_shard_pointer(shard, offset[i]);
+        ASSERT_TRUE(ptr != NULL);
+        EXPECT_EQ(memory_check_value(ptr, elemsize, i), 1);
+        shared_memory_shard_free(shard, ptr);
+    }
+    for (int i = 0; i < nshards; i++)
+        EXPECT_EQ(shared_memory_shard_pool(shard, i)->use_count, 0);
+    EXPECT_TRUE(shared_memory_shard_pointer(shard, offset[0]) == NULL);
+
+    // total count overflow int32
+    int32_t big = 1 << SHM_SHARD_INDEX_BITS;
+    EXPECT_EQ(shared_memory_shard_size(elemsize, big, 128, 8), 0u);
+    EXPECT_TRUE(shared_memory_shard_create(data, elemsize, big, 128, 8) == NULL);
+
+    free(data);
+}
+
+UTEST(shared_memory_pool, owner_dead)
+{
+    int32_t elemsize = 64;
+    int32_t count = 10;
+    size_t size = shared_memory_pool_size(elemsize, count, 8);
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    shared_memory_pool_t *pool = shared_memory_pool_create(data, elemsize, count, 8);
+    void *kept = shared_memory_pool_malloc(pool);
+    ASSERT_TRUE(kept != NULL);
+
+    // die in the middle of malloc, element is popped but not marked
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_lock_acquire(&pool->mutex);
+        int32_t *meta = (int32_t *)pool->data;
+        pool->first = meta[pool->first];
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    for (int i = 0; i < count - 1; i++)
+        EXPECT_TRUE(shared_memory_pool_malloc(pool) != NULL);
+    EXPECT_TRUE(shared_memory_pool_malloc(pool) == NULL);
+    EXPECT_EQ(pool->use_count, count);
+    EXPECT_TRUE(shared_memory_pool_pointer(pool, shared_memory_pool_offset(pool, kept)) == kept);
+
+    munmap(data, size);
+}
+
+UTEST(shared_memory_pool, owner_dead_unreaped)
+{
+    size_t size = shared_memory_pool_size(64, 10, 8);
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    shared_memory_pool_t *pool = shared_memory_pool_create(data, 64, 10, 8);
+
+    // a peer that is not reaped yet stays a zombie holding the lock
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_lock_acquire(&pool->mutex);
+        _exit(0);
+    }
+    siginfo_t info;
+    ASSERT_EQ(waitid(P_PID, pid, &info, WEXITED | WNOWAIT), 0);
+    EXPECT_TRUE(shared_memory_pool_malloc(pool) != NULL);
+    waitpid(pid, NULL, 0);
+
+    munmap(data, size);
+}
+
+UTEST(shared_memory_pool, owner_dead_intrusive)
+{
+    int32_t elemsize = 64;
+    int32_t count = 10;
+    size_t size = shared_memory_pool_size_ex(elemsize, count, 8, SHM_POOL_INTRUSIVE);
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    shared_memory_pool_t *pool = shared_memory_pool_create_ex(data, elemsize, count, 8, SHM_POOL_INTRUSIVE);
+    void *kept = shared_memory_pool_malloc(pool);
+    ASSERT_TRUE(kept != NULL);
+
+    // die in the middle of malloc, element is popped but its bit is not set
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_lock_acquire(&pool->mutex);
+        pool->first = *(int32_t *)(pool->data + pool->datapos + (size_t)pool->first * elemsize);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    for (int i = 0; i < count - 1; i++)
+        EXPECT_TRUE(shared_memory_pool_malloc(pool) != NULL);
+    EXPECT_TRUE(shared_memory_pool_malloc(pool) == NULL);
+    EXPECT_EQ(pool->use_count, count);
+    EXPECT_TRUE(shared_memory_pool_pointer(pool, shared_memory_pool_offset(pool, kept)) == kept);
+
+    munmap(data, size);
+}
+
+UTEST(shared_memory_pool, owner_dead_bitmap)
+{
+    int32_t elemsize = 64;
+    int32_t count = 10;
+    size_t size = shared_memory_pool_size_ex(elemsize, count, 8, SHM_POOL_BITMAP);
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    shared_memory_pool_t *pool = shared_memory_pool_create_ex(data, elemsize, count, 8, SHM_POOL_BITMAP);
+    void *kept = shared_memory_pool_malloc_n(pool, 2);
+    ASSERT_TRUE(kept != NULL);
+
+    // die in the middle of malloc_n, tail of run 2..4 is marked but not its head
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_lock_acquire(&pool->mutex);
+        uint64_t *used = (uint64_t *)pool->data;
+        uint64_t *cont = used + 1;
+        *cont |= 0x18;
+        *used |= 0x18;
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    EXPECT_TRUE(shared_memory_pool_malloc_n(pool, count - 2) != NULL);
+    EXPECT_TRUE(shared_memory_pool_malloc(pool) == NULL);
+    EXPECT_EQ(pool->use_count, count);
+    EXPECT_TRUE(shared_memory_pool_pointer(pool, 0) == kept);
+
+    munmap(data, size);
+}
+
+UTEST(shared_queue, owner_dead)
+{
+    size_t size = shared_queue_size(256);
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    shared_queue_t *queue = shared_queue_create(data, 256);
+    EXPECT_EQ(shared_queue_put(queue, "first", 5), 5);
+
+    // die after writepos moved over a broken record
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_lock_acquire(&queue->mutex);
+        int len = 1000;
+        memcpy(queue->data + queue->writepos, &len, sizeof(int));
+        queue->writepos += sizeof(int) + 8;
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    char buffer[64];
+    EXPECT_EQ(shared_queue_put(queue, "second", 6), 6);
+    EXPECT_EQ(shared_queue_get(queue, buffer, sizeof(buffer)), 5);
+    EXPECT_EQ(memcmp(buffer, "first", 5), 0);
+    EXPECT_EQ(shared_queue_get(queue, buffer, sizeof(buffer)), 6);
+    EXPECT_EQ(memcmp(buffer, "second", 6), 0);
+    EXPECT_EQ(shared_queue_get(queue, buffer, sizeof(buffer)), 0);
+
+    munmap(data, size);
+}
+
+UTEST(shared_queue, owner_dead_shrink)
+{
+    size_t size = shared_queue_size(64);
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    shared_queue_t *queue = shared_queue_create(data, 64);
+    char buffer[64];
+    for (int i = 0; i < 4; i++)
+        EXPECT_EQ(shared_queue_put(queue, "record-0", 8), 8);
+    EXPECT_EQ(shared_queue_get(queue, buffer, sizeof(buffer)), 8);
+
+    // killed in the middle of the memmove, moved part overlaps old records
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_lock_acquire(&queue->mutex);
+        __atomic_store_n(&queue->shrinking, 1, __ATOMIC_RELEASE);
+        memmove(queue->data, queue->data + queue->readpos, 24);
+        kill(getpid(), SIGKILL);
+    }
+    waitpid(pid, NULL, 0);
+
+    EXPECT_EQ(shared_queue_get(queue, buffer, sizeof(buffer)), 0);
+    EXPECT_EQ(shared_queue_put(queue, "after", 5), 5);
+    EXPECT_EQ(shared_queue_get(queue, buffer, sizeof(buffer)), 5);
+    EXPECT_EQ(memcmp(buffer, "after", 5), 0);
+
+    munmap(data, size);
+}
+
+UTEST(shared_memory_pool, stat)
+{
+    size_t size = shared_memory_pool_size(32, 10, 8);
+    void *data = aligned_alloc(64, size);
+    shared_memory_pool_t *pool = shared_memory_pool_create(data, 32, 10, 8);
+    void *a = shared_memory_pool_malloc(pool);
+    shared_memory_pool_malloc(pool);
+
+    shared_memory_pool_stat_t st;
+    shared_memory_pool_stat(pool, &st);
+    EXPECT_EQ(st.count, 10);
+    EXPECT_EQ(st.use_count, 2);
+    EXPECT_EQ(st.free_count, 8);
+    EXPECT_EQ(st.lock_owner, 0u);
+
+    shared_memory_pool_free(pool, a);
+    shm_lock_acquire(&pool->mutex);
+    shared_memory_pool_stat(pool, &st);
+    EXPECT_EQ(st.free_count, 9);
+    EXPECT_EQ(st.lock_owner, shm_lock_self());
+    shm_lock_release(&pool->mutex);
+
+    free(data);
+}
+
+UTEST(shared_queue, stat)
+{
+    size_t size = shared_queue_size(256);
+    void *data = malloc(size);
+    shared_queue_t *queue = shared_queue_create(data, 256);
+    EXPECT_EQ(shared_queue_put(queue, "first", 5), 5);
+    EXPECT_EQ(shared_queue_put(queue, "second", 6), 6);
+
+    shared_queue_stat_t st;
+    shared_queue_stat(queue, &st);
+    EXPECT_EQ(st.size, 256u);
+    EXPECT_EQ(st.records, 2);
+    EXPECT_EQ(st.writepos - st.readpos, (int32_t)(5 + 6 + 2 * sizeof(int)));
+
+    char buffer[64];
+    shared_queue_get(queue, buffer, sizeof(buffer));
+    shared_queue_stat(queue, &st);
+    EXPECT_EQ(st.records, 1);
+
+    free(data);
+}
+
+static int trace_fail_count = 0;
+static int trace_full_count = 0;
+
+static void trace_pool_malloc_fail(shared_memory_pool_t *pool)
+{
+    trace_fail_count++;
+}
+
+static void trace_queue_full(shared_queue_t *queue, int len)
+{
+    trace_full_count++;
+}
+
+UTEST(shm_trace, hooks)
+{
+    shm_trace_hooks_t hooks = {0};
+    hooks.pool_malloc_fail = trace_pool_malloc_fail;
+    hooks.queue_full = trace_queue_full;
+#ifndef SHMUTIL_TRACE_HOOKS
+    // compiled out, hooks are refused and nothing is called
+    EXPECT_EQ(shm_trace_set_hooks(&hooks), -1);
+    size_t psize = shared_memory_pool_size(8, 1, 8);
+    void *pdata = aligned_alloc(64, psize);
+    shared_memory_pool_t *p = shared_memory_pool_create(pdata, 8, 1, 8);
+    shared_memory_pool_malloc(p);
+    EXPECT_TRUE(shared_memory_pool_malloc(p) == NULL);
+    EXPECT_EQ(trace_fail_count, 0);
+    free(pdata);
+    return;
+#endif
+    ASSERT_EQ(shm_trace_set_hooks(&hooks), 0);
+
+    size_t size = shared_memory_pool_size(8, 1, 8) + shared_queue_size(16);
+    uint8_t *data = aligned_alloc(64, size);
+    shared_memory_pool_t *pool = shared_memory_pool_create(data, 8, 1, 8);
+    EXPECT_TRUE(shared_memory_pool_malloc(pool) != NULL);
+    EXPECT_TRUE(shared_memory_pool_malloc(pool) == NULL);
+    EXPECT_EQ(trace_fail_count, 1);
+
+    shared_queue_t *queue = shared_queue_create(data + shared_memory_pool_size(8, 1, 8), 16);
+    EXPECT_EQ(shared_queue_put(queue, "0123456789", 10), 10);
+    EXPECT_EQ(shared_queue_put(queue, "0123456789", 10), 0);
+    EXPECT_EQ(trace_full_count, 1);
+
+    shm_trace_set_hooks(NULL);
+    free(data);
+}
@@ -0,0 +1,127 @@
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "utest.h"
+#include "shm_directory.h"
+
+UTEST(shared_directory, alloc_find)
+{
+    size_t size = 1 << 20;
+    void *data = aligned_alloc(4096, size);
+    shared_directory_t *dir = shared_directory_create(data, size, 10);
+    ASSERT_TRUE(dir != NULL);
+    EXPECT_EQ(dir->capacity, 16);
+
+    shared_memory_pool_t *pool = shared_directory_pool_create(dir, "orders_pool", 100, 50, 64);
+    ASSERT_TRUE(pool != NULL);
+    EXPECT_TRUE((intptr_t)pool % 64 == 0);
+    shared_queue_t *queue = shared_directory_queue_create(dir, "orders_queue", 1024);
+    ASSERT_TRUE(queue != NULL);
+    int *user = shared_directory_alloc(dir, "counter", SHM_OBJECT_USER, 3, sizeof(int), sizeof(int));
+    ASSERT_TRUE(user != NULL);
+    *user = 42;
+
+    // name is unique
+    EXPECT_TRUE(shared_directory_queue_create(dir, "orders_pool", 1024) == NULL);
+    EXPECT_EQ(dir->count, 3);
+
+    shared_directory_t *other = shared_directory_open(data);
+    ASSERT_TRUE(other != NULL);
+    EXPECT_TRUE(shared_directory_pool_open(other, "orders_pool") == pool);
+    EXPECT_TRUE(shared_directory_queue_open(other, "orders_queue") == queue);
+    EXPECT_TRUE(shared_directory_pool_open(other, "orders_queue") == NULL);
+    EXPECT_TRUE(shared_directory_pool_open(other, "missing") == NULL);
+
+    size_t sz = 0;
+    int *found = shared_directory_find(other, "counter", SHM_OBJECT_USER, 3, &sz);
+    ASSERT_TRUE(found != NULL);
+    EXPECT_EQ(*found, 42);
+    EXPECT_EQ(sz, sizeof(int));
+    EXPECT_TRUE(shared_directory_find(other, "counter", SHM_OBJECT_USER, 4, NULL) == NULL);
+
+    // out of space
+    EXPECT_TRUE(shared_directory_alloc(dir, "big", SHM_OBJECT_USER, 1, size, 8) == NULL);
+
+    free(data);
+}
+
+UTEST(shared_directory, full)
+{
+    size_t size = 1 << 16;
+    void *data = aligned_alloc(4096, size);
+    shared_directory_t *dir = shared_directory_create(data, size, 4);
+    ASSERT_TRUE(dir != NULL);
+
+    char name[SHM_OBJECT_NAME_SIZE];
+    for (int i = 0; i < 4; i++) {
+        snprintf(name, sizeof(name), "object_%d", i);
+        EXPECT_TRUE(shared_directory_alloc(dir, name, SHM_OBJECT_USER, 1, 16, 8) != NULL);
+    }
+    EXPECT_TRUE(shared_directory_alloc(dir, "object_4", SHM_OBJECT_USER, 1, 16, 8) == NULL);
+    for (int i = 0; i < 4; i++) {
+        snprintf(name, sizeof(name), "object_%d", i);
+        EXPECT_TRUE(shared_directory_find(dir, name, SHM_OBJECT_USER, 1, NULL) != NULL);
+    }
+
+    free(data);
+}
+
+UTEST(shared_directory, wait_ready)
+{
+    size_t size = 1 << 16;
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    EXPECT_TRUE(shared_directory_wait(data, 10) == NULL);
+
+    // attacher block until creator finish all objects
+    pid_t pid = fork();
+    if (pid == 0) {
+        shared_directory_t *dir = shared_directory_wait(data, 5000);
+        _exit(dir != NULL && shared_directory_queue_open(dir, "ready_queue") != NULL ? 0 : 1);
+    }
+    shared_directory_t *dir = shared_directory_create(data, size, 4);
+    ASSERT_TRUE(dir != NULL);
+    usleep(10000);
+    EXPECT_TRUE(shared_directory_queue_create(dir, "ready_queue", 1024) != NULL);
+    shared_directory_ready(dir, 1);
+
+    int status;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+
+    munmap(data, size);
+}
+
+UTEST(shared_directory, owner_dead)
+{
+    size_t size = 1 << 16;
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    shared_directory_t *dir = shared_directory_create(data, size, 4);
+    ASSERT_TRUE(dir != NULL);
+
+    // die in alloc after the entry is published, before top moves
+    pid_t pid = fork();
+    if (pid == 0) {
+        uint64_t top = dir->top;
+        shared_directory_alloc(dir, "first", SHM_OBJECT_USER, 1, 256, 8);
+        shm_lock_acquire(&dir->mutex);
+        dir->top = top;
+        dir->count--;
+        _exit(0);
+    }
+    siginfo_t info;
+    ASSERT_EQ(waitid(P_PID, pid, &info, WEXITED | WNOWAIT), 0);
+
+    size_t first_size;
+    uint8_t *first = shared_directory_find(dir, "first", SHM_OBJECT_USER, 1, &first_size);
+    ASSERT_TRUE(first != NULL);
+    uint8_t *second = shared_directory_alloc(dir, "second", SHM_OBJECT_USER, 1, 256, 8);
+    ASSERT_TRUE(second != NULL);
+    EXPECT_TRUE(second >= first + first_size);
+    EXPECT_EQ(dir->count, 2);
+    waitpid(pid, NULL, 0);
+
+    munmap(data, size);
+}
@@ -0,0 +1,171 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "utest.h"
+#include "shm_lock.h"
+
+struct lock_counter {
+    shm_lock_t lock;
+    uint64_t value;
+};
+
+static void *lock_counter_run(void *arg)
+{
+    struct lock_counter *c = arg;
+    for (int i = 0; i < 100000; i++) {
+        shm_lock_acquire(&c->lock);
+        c->value++;
+        shm_lock_release(&c->lock);
+    }
+    return NULL;
+}
+
+UTEST(shm_lock, layout)
+{
+    EXPECT_EQ(sizeof(shm_lock_t), 8u);
+
+    shm_lock_t lock;
+    shm_lock_create(&lock, 0);
+    EXPECT_EQ(shm_lock_tryacquire(&lock), 1);
+    EXPECT_EQ(shm_lock_owner(&lock), (uint32_t)syscall(SYS_gettid));
+    EXPECT_EQ(shm_lock_tryacquire(&lock), 0);
+    shm_lock_release(&lock);
+    EXPECT_EQ(lock.state, 0u);
+}
+
+UTEST(shm_lock, threads)
+{
+    struct lock_counter c;
+    shm_lock_create(&c.lock, SHM_LOCK_DEFAULT_SPIN);
+    c.value = 0;
+
+    pthread_t tids[4];
+    for (int i = 0; i < 4; i++)
+        pthread_create(&tids[i], NULL, lock_counter_run, &c);
+    for (int i = 0; i < 4; i++)
+        pthread_join(tids[i], NULL);
+    EXPECT_EQ(c.value, 400000u);
+    EXPECT_EQ(c.lock.state, 0u);
+}
+
+UTEST(shm_lock, processes)
+{
+    struct lock_counter *c = mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(c != MAP_FAILED);
+    shm_lock_create(&c->lock, 0);
+    c->value = 0;
+
+    pid_t pids[3];
+    for (int i = 0; i < 3; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            lock_counter_run(c);
+            _exit(0);
+        }
+    }
+    lock_counter_run(c);
+    for (int i = 0; i < 3; i++)
+        waitpid(pids[i], NULL, 0);
+    EXPECT_EQ(c->value, 400000u);
+
+    munmap(c, sizeof(*c));
+}
+
+UTEST(shm_lock, owner_dead)
+{
+    shm_lock_t *lock = mmap(NULL, sizeof(*lock), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(lock != MAP_FAILED);
+    shm_lock_create(lock, 10);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_lock_acquire(lock);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    EXPECT_EQ(shm_lock_owner(lock), (uint32_t)pid);
+
+    EXPECT_EQ(shm_lock_acquire(lock), EOWNERDEAD);
+    EXPECT_EQ(shm_lock_owner(lock), (uint32_t)syscall(SYS_gettid));
+    shm_lock_release(lock);
+    EXPECT_EQ(shm_lock_acquire(lock), 0);
+    shm_lock_release(lock);
+
+    munmap(lock, sizeof(*lock));
+}
+
+UTEST(shm_lock, owner_dead_unreaped)
+{
+    shm_lock_t *lock = mmap(NULL, sizeof(*lock), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(lock != MAP_FAILED);
+    shm_lock_create(lock, 10);
+
+    // owner is a zombie while we wait, nobody reaps it
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_lock_acquire(lock);
+        _exit(0);
+    }
+    siginfo_t info;
+    ASSERT_EQ(waitid(P_PID, pid, &info, WEXITED | WNOWAIT), 0);
+    EXPECT_EQ(shm_lock_owner_dead(pid), 1);
+    EXPECT_EQ(shm_lock_owner_dead(shm_lock_self()), 0);
+
+    EXPECT_EQ(shm_lock_acquire(lock), EOWNERDEAD);
+    shm_lock_release(lock);
+    waitpid(pid, NULL, 0);
+
+    munmap(lock, sizeof(*lock));
+}
+
+struct rwlock_table {
+    shm_rwlock_t *lock;
+    uint64_t a;
+    uint64_t b;
+    int stop;
+    int bad;
+};
+
+static void *rwlock_reader_run(void *arg)
+{
+    struct rwlock_table *t = arg;
+    while (!__atomic_load_n(&t->stop, __ATOMIC_RELAXED)) {
+        uint32_t slot = shm_rwlock_rdlock(t->lock);
+        if (t->a != t->b)
+            __atomic_store_n(&t->bad, 1, __ATOMIC_RELAXED);
+        shm_rwlock_rdunlock(t->lock, slot);
+    }
+    return NULL;
+}
+
+UTEST(shm_rwlock, readers_writer)
+{
+    size_t size = shm_rwlock_size(4);
+    EXPECT_EQ(size, sizeof(shm_rwlock_t) + 4 * 64);
+    void *data = aligned_alloc(64, size);
+    struct rwlock_table t = {shm_rwlock_create(data, 4), 0, 0, 0, 0};
+    ASSERT_TRUE(t.lock != NULL);
+    EXPECT_TRUE(shm_rwlock_open(data) == t.lock);
+
+    pthread_t tids[3];
+    for (int i = 0; i < 3; i++)
+        pthread_create(&tids[i], NULL, rwlock_reader_run, &t);
+    for (int i = 0; i < 20000; i++) {
+        shm_rwlock_wrlock(t.lock);
+        t.a++;
+        t.b++;
+        shm_rwlock_wrunlock(t.lock);
+    }
+    __atomic_store_n(&t.stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < 3; i++)
+        pthread_join(tids[i], NULL);
+
+    EXPECT_EQ(t.bad, 0);
+    EXPECT_EQ(t.a, 20000u);
+    for (uint32_t i = 0; i < t.lock->nslots; i++)
+        EXPECT_EQ(t.lock->slots[i].count, 0u);
+    free(data);
+}
@@ -0,0 +1,139 @@
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "utest.h"
+#include "shm_log.h"
+
+static void log_test_path(char *buffer, size_t size)
+{
+    snprintf(buffer, size, "/tmp/shm_log_test.%d", (int)getpid());
+}
+
+UTEST(shm_log, append_read)
+{
+    char path[64];
+    log_test_path(path, sizeof(path));
+
+    shm_log_t *log = shm_log_create(path, 256, SHM_LOG_SYNC_NONE);
+    ASSERT_TRUE(log != NULL);
+
+    // records cross several segments
+    char buffer[64];
+    for (int i = 0; i < 100; i++) {
+        int len = snprintf(buffer, sizeof(buffer), "record-%d", i);
+        EXPECT_TRUE(shm_log_append(log, buffer, len) >= 0);
+    }
+    EXPECT_TRUE(shm_log_append(log, buffer, 256) < 0);
+
+    uint64_t offset = 0;
+    const void *data;
+    uint32_t len;
+    for (int i = 0; i < 100; i++) {
+        int n = snprintf(buffer, sizeof(buffer), "record-%d", i);
+        EXPECT_EQ(shm_log_read(log, &offset, &data, &len), 1);
+        EXPECT_EQ((int)len, n);
+        EXPECT_EQ(memcmp(data, buffer, len), 0);
+    }
+    EXPECT_EQ(shm_log_read(log, &offset, &data, &len), 0);
+    EXPECT_EQ(offset, log->header->tail);
+
+    shm_log_close(log);
+    EXPECT_EQ(shm_log_remove(path), 0);
+}
+
+UTEST(shm_log, reopen_offset)
+{
+    char path[64];
+    log_test_path(path, sizeof(path));
+
+    shm_log_t *log = shm_log_create(path, 128, SHM_LOG_SYNC_RECORD);
+    ASSERT_TRUE(log != NULL);
+    uint64_t saved = 0;
+    for (int i = 0; i < 20; i++) {
+        int64_t off = shm_log_append(log, &i, sizeof(i));
+        EXPECT_TRUE(off >= 0);
+        if (i == 10)
+            saved = off;
+    }
+    shm_log_close(log);
+
+    // reader attach after the writer is gone and continue at saved offset
+    log = shm_log_open(path);
+    ASSERT_TRUE(log != NULL);
+    const void *data;
+    uint32_t len;
+    for (int i = 10; i < 20; i++) {
+        EXPECT_EQ(shm_log_read(log, &saved, &data, &len), 1);
+        EXPECT_EQ(len, sizeof(int));
+        EXPECT_EQ(*(const int *)data, i);
+    }
+    EXPECT_EQ(shm_log_read(log, &saved, &data, &len), 0);
+
+    // tail new record from the same offset
+    int v = 20;
+    EXPECT_TRUE(shm_log_append(log, &v, sizeof(v)) >= 0);
+    EXPECT_EQ(shm_log_read(log, &saved, &data, &len), 1);
+    EXPECT_EQ(*(const int *)data, 20);
+
+    EXPECT_EQ(shm_log_trim(log, saved), 0);
+    uint64_t old = 0;
+    EXPECT_EQ(shm_log_read(log, &old, &data, &len), -1);
+
+    shm_log_close(log);
+    EXPECT_EQ(shm_log_remove(path), 0);
+}
+
+UTEST(shm_log, recreate)
+{
+    char path[64], seg[80];
+    log_test_path(path, sizeof(path));
+
+    shm_log_t *log = shm_log_create(path, 128, SHM_LOG_SYNC_NONE);
+    ASSERT_TRUE(log != NULL);
+    for (int i = 0; i < 20; i++)
+        EXPECT_TRUE(shm_log_append(log, &i, sizeof(i)) >= 0);
+    shm_log_close(log);
+
+    // create on the old path starts empty, old segments are gone
+    log = shm_log_create(path, 128, SHM_LOG_SYNC_NONE);
+    ASSERT_TRUE(log != NULL);
+    snprintf(seg, sizeof(seg), "%s.1", path);
+    EXPECT_NE(access(seg, F_OK), 0);
+    uint64_t offset = 0;
+    const void *data;
+    uint32_t len;
+    EXPECT_EQ(shm_log_read(log, &offset, &data, &len), 0);
+
+    int v = 7;
+    EXPECT_EQ(shm_log_append(log, &v, sizeof(v)), 0);
+    EXPECT_EQ(shm_log_read(log, &offset, &data, &len), 1);
+    EXPECT_EQ(*(const int *)data, 7);
+
+    shm_log_close(log);
+    EXPECT_EQ(shm_log_remove(path), 0);
+}
+
+UTEST(shm_log, owner_dead)
+{
+    char path[64];
+    log_test_path(path, sizeof(path));
+
+    shm_log_t *log = shm_log_create(path, 128, SHM_LOG_SYNC_NONE);
+    ASSERT_TRUE(log != NULL);
+
+    // writer dies holding the lock
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_lock_acquire(&log->header->mutex);
+        _exit(0);
+    }
+    ASSERT_TRUE(pid > 0);
+    waitpid(pid, NULL, 0);
+
+    int v = 1;
+    EXPECT_EQ(shm_log_append(log, &v, sizeof(v)), 0);
+    EXPECT_EQ(shm_log_trim(log, log->header->tail), 0);
+
+    shm_log_close(log);
+    EXPECT_EQ(shm_log_remove(path), 0);
+}
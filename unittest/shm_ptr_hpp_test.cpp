@@ -0,0 +1,84 @@
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "utest.h"
+#include "shm_ptr.hpp"
+
+struct tree_node {
+    shm::shm_ptr<tree_node> left;
+    shm::shm_ptr<tree_node> right;
+    int key;
+};
+
+static tree_node *tree_insert(tree_node *nodes, int &used, tree_node *root, int key)
+{
+    tree_node *n = new (&nodes[used++]) tree_node();
+    n->key = key;
+    if (root == nullptr)
+        return n;
+
+    tree_node *p = root;
+    while (true) {
+        shm::shm_ptr<tree_node> &next = key < p->key ? p->left : p->right;
+        if (!next) {
+            next = n;
+            return root;
+        }
+        p = next.get();
+    }
+}
+
+static int tree_walk(const tree_node *n, int *out, int pos)
+{
+    if (n == nullptr)
+        return pos;
+    pos = tree_walk(n->left.get(), out, pos);
+    out[pos++] = n->key;
+    return tree_walk(n->right.get(), out, pos);
+}
+
+UTEST(shm_ptr, cpp_tree)
+{
+    const int count = 32;
+    size_t size = sizeof(tree_node) * count;
+    tree_node *nodes = static_cast<tree_node *>(malloc(size));
+    int used = 0;
+    tree_node *root = nullptr;
+    for (int i = 0; i < count; i++)
+        root = tree_insert(nodes, used, root, (i * 7) % count);
+    ASSERT_EQ(root, &nodes[0]);
+
+    // traverse from other address
+    tree_node *other = static_cast<tree_node *>(malloc(size));
+    memcpy(static_cast<void *>(other), nodes, size);
+    memset(static_cast<void *>(nodes), 0, size);
+
+    int keys[count];
+    EXPECT_EQ(tree_walk(&other[0], keys, 0), count);
+    for (int i = 0; i < count; i++)
+        EXPECT_EQ(keys[i], i);
+
+    // copy keep the target, not the distance
+    shm::shm_ptr<tree_node> a = &other[3];
+    shm::shm_ptr<tree_node> b = a;
+    EXPECT_TRUE(a == b);
+    EXPECT_EQ(b->key, other[3].key);
+    b = nullptr;
+    EXPECT_FALSE(b);
+
+    free(other);
+    free(nodes);
+}
+
+UTEST(shm_ptr, cpp_self)
+{
+    // circular list of one node points to itself
+    struct ring_node {
+        shm::shm_ptr<ring_node> next;
+    } n;
+    EXPECT_FALSE(n.next);
+    n.next = &n;
+    EXPECT_TRUE(n.next);
+    EXPECT_TRUE(n.next == &n);
+}
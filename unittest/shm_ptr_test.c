@@ -0,0 +1,64 @@
+#include "utest.h"
+#include "shm_ptr.h"
+#include "shm_container.h"
+
+struct list_node {
+    shm_relptr_t next;
+    int value;
+};
+
+UTEST(shm_ptr, relptr_list)
+{
+    int32_t count = 64;
+    size_t size = shared_memory_pool_size(sizeof(struct list_node), count, 8);
+    void *data = malloc(size);
+    shared_memory_pool_t *pool = shared_memory_pool_create(data, sizeof(struct list_node), count, 8);
+
+    struct list_node *head = NULL;
+    for (int i = 0; i < count; i++) {
+        struct list_node *n = shared_memory_pool_malloc(pool);
+        ASSERT_TRUE(n != NULL);
+        n->value = i;
+        SHM_RELPTR_SET(n->next, head);
+        head = n;
+    }
+    int32_t head_offset = shared_memory_pool_offset(pool, head);
+
+    // map at other address
+    void *other = malloc(size);
+    memcpy(other, data, size);
+    memset(data, 0, size);
+    pool = shared_memory_pool_open(other);
+    ASSERT_TRUE(pool != NULL);
+
+    int expect = count - 1;
+    for (struct list_node *n = shared_memory_pool_pointer(pool, head_offset); n != NULL;
+         n = SHM_RELPTR_GET(struct list_node, n->next)) {
+        EXPECT_EQ(n->value, expect);
+        expect--;
+    }
+    EXPECT_EQ(expect, -1);
+
+    free(other);
+    free(data);
+}
+
+UTEST(shm_ptr, offptr)
+{
+    uint8_t buffer[64] = {0};
+    EXPECT_TRUE(SHM_OFFPTR_MAKE(buffer, NULL) == 0);
+    EXPECT_TRUE(SHM_OFFPTR_GET(uint8_t, buffer, 0) == NULL);
+
+    shm_offptr_t off = SHM_OFFPTR_MAKE(buffer, buffer + 10);
+    EXPECT_EQ(off, 10u);
+    EXPECT_TRUE(SHM_OFFPTR_GET(uint8_t, buffer, off) == buffer + 10);
+}
+
+UTEST(shm_ptr, relptr_self)
+{
+    struct list_node n = {0};
+    SHM_RELPTR_SET(n.next, &n);
+    EXPECT_TRUE(SHM_RELPTR_GET(struct list_node, n.next) == &n);
+    SHM_RELPTR_SET(n.next, NULL);
+    EXPECT_TRUE(SHM_RELPTR_GET(struct list_node, n.next) == NULL);
+}
@@ -0,0 +1,246 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "utest.h"
+#include "shm_rpc.h"
+
+// reply request + 1 until a request of 0
+static void rpc_serve(shm_rpc_t *rpc)
+{
+    shm_rpc_request_t req;
+    int64_t value;
+    while (1) {
+        int len = sizeof(value);
+        if (shm_rpc_recv(rpc, &req, &value, &len, 5000) != 0)
+            break;
+        int stop = value == 0;
+        value++;
+        shm_rpc_reply(rpc, &req, &value, sizeof(value));
+        if (stop)
+            break;
+    }
+}
+
+static void *rpc_server_run(void *arg)
+{
+    rpc_serve(arg);
+    return NULL;
+}
+
+UTEST(shm_rpc, attach)
+{
+    void *data = aligned_alloc(64, shm_rpc_size(2, 64));
+    EXPECT_TRUE(shm_rpc_create(data, 0, 64) == NULL);
+    shm_rpc_t *rpc = shm_rpc_create(data, 2, 64);
+    ASSERT_TRUE(rpc != NULL);
+    EXPECT_TRUE(shm_rpc_open(data) == rpc);
+
+    EXPECT_EQ(shm_rpc_attach(rpc), 0);
+    EXPECT_EQ(shm_rpc_attach(rpc), 1);
+    EXPECT_EQ(shm_rpc_attach(rpc), -1);
+    shm_rpc_detach(rpc, 0);
+    EXPECT_EQ(shm_rpc_attach(rpc), 0);
+
+    char big[65] = {0};
+    int len = sizeof(big);
+    EXPECT_EQ(shm_rpc_call(rpc, 0, big, sizeof(big), big, &len, 0), EMSGSIZE);
+    EXPECT_EQ(shm_rpc_call(rpc, 2, big, 8, big, &len, 0), EINVAL);
+    shm_rpc_request_t req;
+    len = 8;
+    EXPECT_EQ(shm_rpc_recv(rpc, &req, big, &len, 0), EINVAL);
+
+    free(data);
+}
+
+UTEST(shm_rpc, processes)
+{
+    int callers = 4;
+    int calls = 1000;
+    size_t size = shm_rpc_size(callers, sizeof(int64_t));
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    shm_rpc_t *rpc = shm_rpc_create(data, callers, sizeof(int64_t));
+
+    pid_t server = fork();
+    if (server == 0) {
+        rpc_serve(rpc);
+        _exit(0);
+    }
+
+    // every caller must get the answer of its own request
+    pid_t pids[4];
+    for (int c = 0; c < callers; c++) {
+        if ((pids[c] = fork()) == 0) {
+            int32_t slot = shm_rpc_attach(rpc);
+            if (slot < 0)
+                _exit(1);
+            for (int i = 1; i <= calls; i++) {
+                int64_t value = (int64_t)(c + 1) * 1000000 + i;
+                int64_t resp = 0;
+                int len = sizeof(resp);
+                if (shm_rpc_call(rpc, slot, &value, sizeof(value), &resp, &len, 5000) != 0 ||
+                    len != sizeof(resp) || resp != value + 1)
+                    _exit(2);
+            }
+            shm_rpc_detach(rpc, slot);
+            _exit(0);
+        }
+    }
+    for (int c = 0; c < callers; c++) {
+        int status = -1;
+        waitpid(pids[c], &status, 0);
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    int32_t slot = shm_rpc_attach(rpc);
+    int64_t value = 0;
+    int len = sizeof(value);
+    EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 5000), 0);
+    EXPECT_EQ(value, 1);
+    waitpid(server, NULL, 0);
+
+    munmap(data, size);
+}
+
+static void *rpc_slow_server_run(void *arg)
+{
+    shm_rpc_t *rpc = arg;
+    shm_rpc_request_t req;
+    int64_t value;
+    int len = sizeof(value);
+    if (shm_rpc_recv(rpc, &req, &value, &len, 5000) == 0) {
+        usleep(100 * 1000);
+        value = shm_rpc_reply(rpc, &req, &value, sizeof(value));
+    }
+    return (void *)(intptr_t)value;
+}
+
+UTEST(shm_rpc, timeout)
+{
+    void *data = aligned_alloc(64, shm_rpc_size(1, sizeof(int64_t)));
+    shm_rpc_t *rpc = shm_rpc_create(data, 1, sizeof(int64_t));
+    int32_t slot = shm_rpc_attach(rpc);
+    int64_t value = 5;
+    int len = sizeof(value);
+
+    // nobody takes it, the canceled request is skipped by the server
+    EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 10), ETIMEDOUT);
+    shm_rpc_request_t req;
+    EXPECT_EQ(shm_rpc_recv(rpc, &req, &value, &len, 10), ETIMEDOUT);
+
+    // taken but answered late, the server is told and the slot waits for it
+    pthread_t server;
+    pthread_create(&server, NULL, rpc_slow_server_run, rpc);
+    EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 50), ETIMEDOUT);
+    void *r;
+    pthread_join(server, &r);
+    EXPECT_EQ((int)(intptr_t)r, ECANCELED);
+
+    pthread_create(&server, NULL, rpc_server_run, rpc);
+    value = 0;
+    len = sizeof(value);
+    EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 5000), 0);
+    EXPECT_EQ(value, 1);
+    pthread_join(server, NULL);
+
+    free(data);
+}
+
+UTEST(shm_rpc, canceled_calls)
+{
+    void *data = aligned_alloc(64, shm_rpc_size(1, sizeof(int64_t)));
+    shm_rpc_t *rpc = shm_rpc_create(data, 1, sizeof(int64_t));
+    int32_t slot = shm_rpc_attach(rpc);
+    int64_t value = 5;
+    int len = sizeof(value);
+
+    // no server, every canceled call reuses the entry left in the ring
+    for (int i = 0; i < 10; i++)
+        EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 1), ETIMEDOUT);
+    EXPECT_EQ(rpc->tail - rpc->head, 1u);
+
+    pthread_t server;
+    pthread_create(&server, NULL, rpc_server_run, rpc);
+    value = 0;
+    EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 5000), 0);
+    EXPECT_EQ(value, 1);
+    pthread_join(server, NULL);
+
+    free(data);
+}
+
+UTEST(shm_rpc, dead_pusher)
+{
+    void *data = aligned_alloc(64, shm_rpc_size(2, sizeof(int64_t)));
+    shm_rpc_t *rpc = shm_rpc_create(data, 2, sizeof(int64_t));
+    int32_t slot = shm_rpc_attach(rpc);
+
+    // a caller died after it took a ring cell and before it filled it
+    rpc->tail++;
+
+    pthread_t server;
+    pthread_create(&server, NULL, rpc_server_run, rpc);
+    int64_t value = 0;
+    int len = sizeof(value);
+    EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 5000), 0);
+    EXPECT_EQ(value, 1);
+    pthread_join(server, NULL);
+    EXPECT_EQ(rpc->tail, rpc->head);
+
+    free(data);
+}
+
+// take one request and die without reply, after delay_ms
+static void rpc_die_serving(shm_rpc_t *rpc, int delay_ms)
+{
+    shm_rpc_request_t req;
+    int64_t value;
+    int len = sizeof(value);
+    if (shm_rpc_recv(rpc, &req, &value, &len, 5000) == 0)
+        usleep(delay_ms * 1000);
+    _exit(0);
+}
+
+UTEST(shm_rpc, server_dead)
+{
+    size_t size = shm_rpc_size(1, sizeof(int64_t));
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(data != MAP_FAILED);
+    shm_rpc_t *rpc = shm_rpc_create(data, 1, sizeof(int64_t));
+    int32_t slot = shm_rpc_attach(rpc);
+    int64_t value = 5;
+    int len = sizeof(value);
+
+    // server dies serving, not reaped while the caller waits
+    pid_t pid = fork();
+    if (pid == 0)
+        rpc_die_serving(rpc, 0);
+    EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 5000), EOWNERDEAD);
+    waitpid(pid, NULL, 0);
+
+    // caller gave up first, the abandoned slot is taken back when the server dies
+    pid = fork();
+    if (pid == 0)
+        rpc_die_serving(rpc, 100);
+    EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 20), ETIMEDOUT);
+
+    // server died after it popped the entry and before it cleared queued
+    EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 500), ETIMEDOUT);
+    rpc->head = rpc->tail;
+
+    pthread_t server;
+    pthread_create(&server, NULL, rpc_server_run, rpc);
+    value = 0;
+    len = sizeof(value);
+    EXPECT_EQ(shm_rpc_call(rpc, slot, &value, sizeof(value), &value, &len, 5000), 0);
+    EXPECT_EQ(value, 1);
+    pthread_join(server, NULL);
+    waitpid(pid, NULL, 0);
+
+    munmap(data, size);
+}
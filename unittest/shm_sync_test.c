@@ -0,0 +1,202 @@
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "utest.h"
+#include "shm_sync.h"
+
+UTEST(shm_event, auto_manual)
+{
+    shm_event_t event;
+    shm_event_create(&event, 0, 1);
+    EXPECT_EQ(shm_event_wait(&event, 0), 0);
+    EXPECT_EQ(shm_event_wait(&event, 10), ETIMEDOUT);
+
+    shm_event_create(&event, 1, 0);
+    EXPECT_EQ(shm_event_wait(&event, 10), ETIMEDOUT);
+    shm_event_set(&event);
+    EXPECT_EQ(shm_event_wait(&event, 0), 0);
+    EXPECT_EQ(shm_event_wait(&event, 0), 0);
+    shm_event_reset(&event);
+    EXPECT_EQ(shm_event_wait(&event, 0), ETIMEDOUT);
+}
+
+UTEST(shm_event, processes)
+{
+    shm_event_t *events = mmap(NULL, sizeof(shm_event_t) * 2, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(events != MAP_FAILED);
+    shm_event_create(&events[0], 0, 0);
+    shm_event_create(&events[1], 0, 0);
+
+    // ping pong between processes
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (int i = 0; i < 1000; i++) {
+            shm_event_wait(&events[0], SHM_WAIT_INFINITE);
+            shm_event_set(&events[1]);
+        }
+        _exit(0);
+    }
+    for (int i = 0; i < 1000; i++) {
+        shm_event_set(&events[0]);
+        EXPECT_EQ(shm_event_wait(&events[1], 5000), 0);
+    }
+    waitpid(pid, NULL, 0);
+
+    munmap(events, sizeof(shm_event_t) * 2);
+}
+
+struct sem_test {
+    shm_sem_t sem;
+    int taken;
+};
+
+static void *sem_consumer_run(void *arg)
+{
+    struct sem_test *t = arg;
+    for (int i = 0; i < 1000; i++) {
+        if (shm_sem_wait(&t->sem, 5000) == 0)
+            __atomic_add_fetch(&t->taken, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+UTEST(shm_sem, batch_post)
+{
+    struct sem_test t;
+    shm_sem_create(&t.sem, 2);
+    t.taken = 0;
+    EXPECT_EQ(shm_sem_trywait(&t.sem), 0);
+    EXPECT_EQ(shm_sem_trywait(&t.sem), 0);
+    EXPECT_EQ(shm_sem_trywait(&t.sem), EAGAIN);
+    EXPECT_EQ(shm_sem_wait(&t.sem, 10), ETIMEDOUT);
+
+    pthread_t tids[4];
+    for (int i = 0; i < 4; i++)
+        pthread_create(&tids[i], NULL, sem_consumer_run, &t);
+    for (int i = 0; i < 400; i++)
+        shm_sem_post(&t.sem, 10);
+    for (int i = 0; i < 4; i++)
+        pthread_join(tids[i], NULL);
+
+    EXPECT_EQ(t.taken, 4000);
+    EXPECT_EQ(t.sem.value, 0u);
+    EXPECT_EQ(t.sem.waiters, 0u);
+}
+
+struct cond_test {
+    shm_lock_t lock;
+    shm_cond_t cond;
+    int value;
+};
+
+static void *cond_waiter_run(void *arg)
+{
+    struct cond_test *t = arg;
+    shm_lock_acquire(&t->lock);
+    while (t->value == 0)
+        shm_cond_wait(&t->cond, &t->lock, SHM_WAIT_INFINITE);
+    t->value++;
+    shm_lock_release(&t->lock);
+    return NULL;
+}
+
+UTEST(shm_cond, broadcast)
+{
+    struct cond_test t;
+    shm_lock_create(&t.lock, SHM_LOCK_DEFAULT_SPIN);
+    shm_cond_create(&t.cond);
+    t.value = 0;
+
+    shm_lock_acquire(&t.lock);
+    EXPECT_EQ(shm_cond_wait(&t.cond, &t.lock, 10), ETIMEDOUT);
+    EXPECT_EQ(shm_lock_owner(&t.lock), shm_lock_self());
+    shm_lock_release(&t.lock);
+
+    pthread_t tids[3];
+    for (int i = 0; i < 3; i++)
+        pthread_create(&tids[i], NULL, cond_waiter_run, &t);
+    usleep(10000);
+
+    shm_lock_acquire(&t.lock);
+    t.value = 1;
+    shm_cond_broadcast(&t.cond);
+    shm_lock_release(&t.lock);
+    for (int i = 0; i < 3; i++)
+        pthread_join(tids[i], NULL);
+    EXPECT_EQ(t.value, 4);
+}
+
+UTEST(shm_once, processes)
+{
+    shm_once_t *once = mmap(NULL, sizeof(shm_once_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(once != MAP_FAILED);
+    // zero filled memory is not ready yet
+    EXPECT_EQ(shm_once_wait(once, 10), ETIMEDOUT);
+
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(shm_once_wait(once, 5000));
+    usleep(10000);
+    EXPECT_EQ(shm_once_begin(once), 1);
+    EXPECT_EQ(shm_once_begin(once), 0);
+    shm_once_end(once, 1);
+    int status;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+    EXPECT_EQ(shm_once_wait(once, 0), 0);
+
+    // failed init can be retried
+    shm_once_reset(once);
+    shm_once_end(once, 0);
+    EXPECT_EQ(shm_once_wait(once, 0), ECANCELED);
+    EXPECT_EQ(shm_once_begin(once), 1);
+
+    munmap(once, sizeof(shm_once_t));
+}
+
+UTEST(shm_barrier, processes)
+{
+    shm_barrier_t *barrier = mmap(NULL, sizeof(shm_barrier_t), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_TRUE(barrier != MAP_FAILED);
+    EXPECT_EQ(shm_barrier_create(barrier, 0), -1);
+    ASSERT_EQ(shm_barrier_create(barrier, 4), 0);
+
+    // a timed out waiter is not counted
+    EXPECT_EQ(shm_barrier_wait(barrier, 10), ETIMEDOUT);
+
+    pid_t pids[3];
+    for (int i = 0; i < 3; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            int serial = 0;
+            for (int round = 0; round < 100; round++) {
+                int r = shm_barrier_wait(barrier, 5000);
+                if (r == ETIMEDOUT)
+                    _exit(100);
+                serial += r == SHM_BARRIER_SERIAL;
+            }
+            _exit(serial);
+        }
+    }
+    int serial = 0;
+    for (int round = 0; round < 100; round++) {
+        int r = shm_barrier_wait(barrier, 5000);
+        EXPECT_NE(r, ETIMEDOUT);
+        serial += r == SHM_BARRIER_SERIAL;
+    }
+    for (int i = 0; i < 3; i++) {
+        int status;
+        waitpid(pids[i], &status, 0);
+        EXPECT_NE(WEXITSTATUS(status), 100);
+        serial += WEXITSTATUS(status);
+    }
+    // exactly one serial waiter each round
+    EXPECT_EQ(serial, 100);
+
+    munmap(barrier, sizeof(shm_barrier_t));
+}
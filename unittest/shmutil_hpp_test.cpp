@@ -0,0 +1,110 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "utest.h"
+#include "shmutil.hpp"
+
+struct order {
+    static int alive;
+
+    order(int i, double p) : id(i), price(p) { alive++; }
+    ~order() { alive--; }
+
+    int id;
+    double price;
+    char symbol[20];
+};
+
+int order::alive = 0;
+
+typedef shm::pool<order, 16> order_pool;
+
+static_assert(order_pool::elemsize == 40, "elemsize is rounded up to Align");
+static_assert(shm::pool<char[100], 4, 64>::elemsize == 128, "elemsize is rounded up to Align");
+
+UTEST(shm_pool_hpp, layout)
+{
+    EXPECT_EQ(order_pool::size, shared_memory_pool_size(sizeof(order), 16, 8));
+    EXPECT_EQ((shm::pool<char[100], 4, 64>::size), shared_memory_pool_size(100, 4, 64));
+    EXPECT_EQ(shm::queue<1024>::size, shared_queue_size(1024));
+}
+
+UTEST(shm_pool_hpp, make_adopt)
+{
+    void *data = aligned_alloc(64, order_pool::size);
+    order_pool pool = order_pool::create(data);
+    ASSERT_TRUE(pool);
+
+    {
+        order_pool::handle h = pool.make(7, 1.5);
+        ASSERT_TRUE(h);
+        EXPECT_EQ(h->id, 7);
+        EXPECT_EQ(order::alive, 1);
+        EXPECT_EQ(pool.raw()->use_count, 1);
+        EXPECT_EQ(pool.offset(h.get()), shared_memory_pool_offset(pool.raw(), h.get()));
+    }
+    EXPECT_EQ(order::alive, 0);
+    EXPECT_EQ(pool.raw()->use_count, 0);
+
+    // pass ownership by offset, like to another process
+    order_pool::handle h = pool.make(8, 2.5);
+    int32_t off = h.release();
+    EXPECT_FALSE(h);
+    EXPECT_EQ(order::alive, 1);
+
+    order_pool other = order_pool::open(data);
+    ASSERT_TRUE(other);
+    order_pool::handle got = other.adopt(off);
+    ASSERT_TRUE(got);
+    EXPECT_EQ(got->id, 8);
+    EXPECT_TRUE(other.pointer(16) == nullptr);
+    EXPECT_EQ(other.offset(got.get() + 1), off + 1);
+    got.reset();
+    EXPECT_EQ(order::alive, 0);
+
+    // different layout is refused
+    EXPECT_FALSE((shm::pool<order, 8>::open(data)));
+
+    order_pool::handle all[16];
+    for (int i = 0; i < 16; i++)
+        all[i] = pool.make(i, 0.0);
+    EXPECT_FALSE(pool.make(16, 0.0));
+    EXPECT_EQ(order::alive, 16);
+    for (int i = 0; i < 16; i++)
+        all[i].reset();
+    EXPECT_EQ(pool.raw()->use_count, 0);
+
+    free(data);
+}
+
+struct tick {
+    int64_t time;
+    double price;
+};
+
+UTEST(shm_queue_hpp, push_pop)
+{
+    void *data = malloc(shm::queue<256>::size);
+    shm::queue<256> q = shm::queue<256>::create(data);
+    ASSERT_TRUE(q);
+    EXPECT_FALSE(shm::queue<512>::open(data));
+
+    shm::queue<256> other = shm::queue<256>::open(data);
+    ASSERT_TRUE(other);
+    tick t = {100, 1.25};
+    EXPECT_TRUE(q.push(t));
+    tick r = {0, 0};
+    EXPECT_TRUE(other.pop(r));
+    EXPECT_EQ(r.time, 100);
+    EXPECT_FALSE(other.pop(r));
+
+    // a record of other size is not consumed
+    int64_t n = 7;
+    EXPECT_TRUE(q.push(n));
+    EXPECT_FALSE(other.pop(r));
+    int64_t m = 0;
+    EXPECT_TRUE(other.pop(m));
+    EXPECT_EQ(m, 7);
+
+    free(data);
+}
@@ -0,0 +1,255 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "utest.h"
+#include "shmutil.h"
+
+static void shm_test_name(char *buffer, size_t size, const char *tag)
+{
+    snprintf(buffer, size, "/shmutil_test_%s_%d", tag, (int)getpid());
+}
+
+UTEST(shared_memory, create_open)
+{
+    char name[64];
+    shm_test_name(name, sizeof(name), "create");
+
+    shm_info_t *shm = shared_memory_create(name, 10000);
+    ASSERT_TRUE(shm != NULL);
+    EXPECT_EQ(shm->size, 10000u);
+    EXPECT_EQ(shm->flags, 0u);
+    memset(shm->ptr, 0x5a, shm->size);
+
+    shm_info_t *other = shared_memory_open(name);
+    ASSERT_TRUE(other != NULL);
+    EXPECT_EQ(other->size, 10000u);
+    EXPECT_EQ(((uint8_t *)other->ptr)[9999], 0x5a);
+
+    shared_memory_close(other);
+    shared_memory_close(shm);
+    EXPECT_EQ(shared_memory_remove(name), 0);
+    EXPECT_TRUE(shared_memory_open(name) == NULL);
+}
+
+UTEST(shared_memory, read_only)
+{
+    char name[64];
+    shm_test_name(name, sizeof(name), "rdonly");
+
+    shm_info_t *shm = shared_memory_create_ex(name, 10000, SHM_FLAG_RDONLY);
+    ASSERT_TRUE(shm != NULL);
+    EXPECT_EQ(shm->flags, 0u);
+    memset(shm->ptr, 0x5a, shm->size);
+
+    shm_info_t *other = shared_memory_open_ex(name, SHM_FLAG_RDONLY);
+    ASSERT_TRUE(other != NULL);
+    EXPECT_EQ(other->flags, (uint32_t)SHM_FLAG_RDONLY);
+    EXPECT_EQ(((uint8_t *)other->ptr)[9999], 0x5a);
+    EXPECT_EQ(shared_memory_prefault(other, 1), -1);
+
+    shared_memory_close(other);
+    shared_memory_close(shm);
+    EXPECT_EQ(shared_memory_remove(name), 0);
+}
+
+UTEST(shared_memory, huge_page)
+{
+    char name[64];
+    shm_test_name(name, sizeof(name), "huge");
+
+    // hugetlbfs may not be reserved, must fall back to normal pages
+    size_t size = 4 << 20;
+    shm_info_t *shm = shared_memory_create_ex(name, size, SHM_FLAG_HUGETLB);
+    ASSERT_TRUE(shm != NULL);
+    EXPECT_TRUE(shm->size >= size);
+    EXPECT_TRUE(shm->size % shm->pagesize == 0);
+    if (shm->flags & SHM_FLAG_HUGETLB)
+        EXPECT_TRUE(shm->pagesize > 4096u);
+    memset(shm->ptr, 1, size);
+
+    shm_info_t *other = shared_memory_open_ex(name, SHM_FLAG_THP);
+    ASSERT_TRUE(other != NULL);
+    EXPECT_EQ(other->size, shm->size);
+    EXPECT_TRUE((other->flags & SHM_FLAG_HUGETLB) == (shm->flags & SHM_FLAG_HUGETLB));
+    EXPECT_EQ(((uint8_t *)other->ptr)[size - 1], 1);
+
+    shared_memory_close(other);
+    shared_memory_close(shm);
+    EXPECT_EQ(shared_memory_remove(name), 0);
+}
+
+UTEST(shared_memory, prefault)
+{
+    char name[64];
+    shm_test_name(name, sizeof(name), "prefault");
+
+    size_t size = 8 << 20;
+    shm_info_t *shm = shared_memory_create_ex(name, size, SHM_FLAG_POPULATE | SHM_FLAG_PREFAULT | SHM_FLAG_LOCK);
+    ASSERT_TRUE(shm != NULL);
+    EXPECT_TRUE(shm->flags & SHM_FLAG_POPULATE);
+    EXPECT_TRUE(shm->flags & SHM_FLAG_PREFAULT);
+    memset(shm->ptr, 7, size);
+
+    // prefault by other process must keep the content
+    shm_info_t *other = shared_memory_open_ex(name, SHM_FLAG_PREFAULT);
+    ASSERT_TRUE(other != NULL);
+    EXPECT_TRUE(other->flags & SHM_FLAG_PREFAULT);
+    EXPECT_EQ(shared_memory_prefault(other, 4), 0);
+    for (size_t i = 0; i < size; i += 4096)
+        EXPECT_EQ(((uint8_t *)other->ptr)[i], 7);
+
+    shared_memory_close(other);
+    shared_memory_close(shm);
+    EXPECT_EQ(shared_memory_remove(name), 0);
+}
+
+UTEST(shared_memory, anon_fd_passing)
+{
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    shm_info_t *shm = shared_memory_create_anon("anon_test", 1 << 20, SHM_FLAG_SEAL);
+    ASSERT_TRUE(shm != NULL);
+    EXPECT_TRUE(shm->flags & SHM_FLAG_SEAL);
+    strcpy(shm->ptr, "hello");
+    EXPECT_TRUE(ftruncate(shm->fd, 4096) != 0);
+
+    EXPECT_EQ(shared_memory_send(sv[0], shm), 0);
+    shm_info_t *other = shared_memory_recv(sv[1], 0);
+    ASSERT_TRUE(other != NULL);
+    EXPECT_EQ(other->size, shm->size);
+    EXPECT_TRUE(other->flags & SHM_FLAG_SEAL);
+    EXPECT_STREQ((char *)other->ptr, "hello");
+
+    // both side see the same memory
+    strcpy(other->ptr, "world");
+    EXPECT_STREQ((char *)shm->ptr, "world");
+
+    shared_memory_close(other);
+    shared_memory_close(shm);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+UTEST(shared_memory, grow_remap)
+{
+    char name[64];
+    shm_test_name(name, sizeof(name), "grow");
+
+    shm_info_t *shm = shared_memory_create_ex(name, 4096, SHM_FLAG_GROWABLE);
+    ASSERT_TRUE(shm != NULL);
+    EXPECT_TRUE(shm->flags & SHM_FLAG_GROWABLE);
+    uint8_t *data = shared_memory_data(shm);
+    data[0] = 11;
+
+    shm_info_t *other = shared_memory_open(name);
+    ASSERT_TRUE(other != NULL);
+    EXPECT_TRUE(other->flags & SHM_FLAG_GROWABLE);
+    EXPECT_EQ(shared_memory_remap(other), 0);
+
+    size_t size = 1 << 20;
+    EXPECT_EQ(shared_memory_grow(shm, size), 0);
+    EXPECT_EQ(shm->size, size);
+    data = shared_memory_data(shm);
+    data[size - sizeof(shm_segment_t) - 1] = 22;
+
+    // offset keep valid after remap
+    EXPECT_EQ(shared_memory_remap(other), 1);
+    EXPECT_EQ(other->size, size);
+    EXPECT_EQ(other->generation, shm->generation);
+    data = shared_memory_data(other);
+    EXPECT_EQ(data[0], 11);
+    EXPECT_EQ(data[size - sizeof(shm_segment_t) - 1], 22);
+    EXPECT_EQ(shared_memory_remap(other), 0);
+
+    shared_memory_close(other);
+    shared_memory_close(shm);
+    EXPECT_EQ(shared_memory_remove(name), 0);
+}
+
+UTEST(shared_memory, grow_both)
+{
+    char name[64];
+    shm_test_name(name, sizeof(name), "grow_both");
+
+    shm_info_t *shm = shared_memory_create_ex(name, 4096, SHM_FLAG_GROWABLE);
+    ASSERT_TRUE(shm != NULL);
+    shm_info_t *other = shared_memory_open(name);
+    ASSERT_TRUE(other != NULL);
+
+    // a stale grower must not shrink the segment
+    EXPECT_EQ(shared_memory_grow(shm, 1 << 20), 0);
+    EXPECT_EQ(shared_memory_grow(other, 1 << 16), 0);
+    EXPECT_EQ(other->size, (size_t)(1 << 20));
+    EXPECT_EQ(other->generation, shm->generation);
+
+    EXPECT_EQ(shared_memory_grow(other, 2 << 20), 0);
+    EXPECT_EQ(shared_memory_remap(shm), 1);
+    EXPECT_EQ(shm->size, (size_t)(2 << 20));
+
+    shared_memory_close(other);
+    shared_memory_close(shm);
+    EXPECT_EQ(shared_memory_remove(name), 0);
+}
+
+UTEST(shared_memory, open_while_grow)
+{
+    char name[64];
+    shm_test_name(name, sizeof(name), "open_grow");
+
+    shm_info_t *shm = shared_memory_create_ex(name, 4096, SHM_FLAG_GROWABLE);
+    ASSERT_TRUE(shm != NULL);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (size_t size = 8192; size <= (4 << 20); size += 4096)
+            shared_memory_grow(shm, size);
+        _exit(0);
+    }
+
+    // open must cover the segment size whenever the grow happens
+    int opened = 0;
+    do {
+        shm_info_t *other = shared_memory_open(name);
+        ASSERT_TRUE(other != NULL);
+        shm_segment_t *seg = other->ptr;
+        EXPECT_TRUE(other->size >= seg->size || seg->generation != other->generation);
+        shared_memory_close(other);
+        opened++;
+    } while (waitpid(pid, NULL, WNOHANG) == 0);
+    EXPECT_TRUE(opened > 0);
+
+    EXPECT_EQ(shared_memory_remap(shm), 1);
+    EXPECT_EQ(shm->size, (size_t)(4 << 20));
+    shared_memory_close(shm);
+    EXPECT_EQ(shared_memory_remove(name), 0);
+}
+
+UTEST(shared_memory, numa)
+{
+    int nodes = shared_memory_numa_nodes();
+    EXPECT_TRUE(nodes >= 1);
+    EXPECT_TRUE(shared_memory_numa_node() < nodes);
+
+    char name[64];
+    shm_test_name(name, sizeof(name), "numa");
+    shm_info_t *shm = shared_memory_create_ex(name, 1 << 20, SHM_FLAG_NUMA_INTERLEAVE | SHM_FLAG_POPULATE);
+    ASSERT_TRUE(shm != NULL);
+    // populate is reported only if pages are really in, with or without interleave
+    if (shm->flags & SHM_FLAG_POPULATE) {
+        unsigned char vec[256];
+        ASSERT_EQ(mincore(shm->ptr, 1 << 20, vec), 0);
+        for (long i = 0; i < (1 << 20) / sysconf(_SC_PAGESIZE); i++)
+            EXPECT_TRUE(vec[i] & 1);
+    }
+    // mbind may be filtered by seccomp in container
+    int r = shared_memory_numa_bind(shm->ptr, 4096, SHM_NUMA_PREFERRED, 1);
+    EXPECT_TRUE(r == 0 || errno == EPERM || errno == ENOSYS);
+    EXPECT_TRUE(shared_memory_numa_bind(shm->ptr, 4096, SHM_NUMA_BIND, 0) != 0);
+
+    shared_memory_close(shm);
+    EXPECT_EQ(shared_memory_remove(name), 0);
+}